@@ -1,4 +1,23 @@
 ﻿# include <Siv3D.hpp> // OpenSiv3D v0.6.12
+# include <atomic>
+# include <bit>
+# include <concepts>
+# include <condition_variable>
+# include <cstdlib>
+# include <functional>
+# include <memory>
+# include <memory_resource>
+# include <mutex>
+# include <new>
+# include <queue>
+# include <span>
+# include <thread>
+
+# if SIV3D_PLATFORM(WINDOWS)
+// GetAsyncKeyState()（user32）と timeBeginPeriod() / timeEndPeriod()（winmm）
+# include <Siv3D/Windows/Windows.hpp>
+# include <timeapi.h>
+# endif
 
 namespace
 {
@@ -12,601 +31,5376 @@ namespace
 
 	// シーンサイズに対するレンダーテクスチャのサイズ（倍率、整数倍）
 	constexpr int RenderTextureScale = 2;
+
+	// 2D 物理演算のシミュレーションの刻み
+	constexpr double StepSec = 1.0 / 200.0;
+
+	// ステージ数
+	constexpr int StageCount = 3;
 }
 
-struct SmokeEffect : IEffect
+// ヒープ確保の回数（統計情報に 1 フレームあたりの回数を出す）
+namespace AllocationCounter
 {
-	SmokeEffect(const Vec2& pos, double forwardAngle, double scale = 1.0)
-		:
-		pos_{ pos + RandomVec2(2.0) },
-		forwardAngle_{ forwardAngle + Random(-30_deg, 30_deg) },
-		scale_{ scale },
-		speed_{ Random(0.08, 0.5 + 1.0 * scale) }
+	inline std::atomic<uint64> count = 0;
+
+	inline uint64 Count()
 	{
+		return count.load(std::memory_order_relaxed);
 	}
+}
 
-	bool update(double t) override
-	{
-		const double Lifetime = 0.2 * scale_;
-		const double t0_1 = t / Lifetime;
+void* operator new(std::size_t size)
+{
+	AllocationCounter::count.fetch_add(1, std::memory_order_relaxed);
 
-		pos_ += Circular{ speed_, forwardAngle_ + 180_deg };
+	if (void* p = std::malloc(size ? size : 1))
+	{
+		return p;
+	}
 
-		Circle{ pos_, (2.0 + 6.0 * t0_1) * scale_ }
-			.draw(ColorF{ 1.0, 1.0 - EaseInCubic(t0_1) })
-			.drawFrame((3.0 * (1.0 - t0_1)) * scale_, 0.0, ColorF{ 1.0, 1.0 - 0.5 * (t0_1) });
+	throw std::bad_alloc{};
+}
 
-		return t < Lifetime;
-	}
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
 
-	Vec2 pos_;
-	double forwardAngle_;
-	double scale_;
-	double speed_;
-};
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
 
-struct SparkEffect : IEffect
+// 単調増加のアリーナ
+// 確保は先頭からずらしていくだけで個別には解放せず、reset() でまとめて O(1) で捨てる
+// 容量を超えた分は通常のヒープから確保し、その回数を数える
+class MonotonicArena : public std::pmr::memory_resource
 {
-	SparkEffect(const Vec2& pos, double speed)
-		:
-		amp_{ Clamp(EaseOutCubic(speed / 700.0), 0.1, 1.0) },
-		pos_{ pos + RandomVec2(Random(0.0, 4.0)) },
-		vel_{ Random(1.0, 8.0) * amp_, Math::TwoPi * Random() },
-		lifetime_{ (0.3 + Random(-0.1, 0.1)) * amp_ }
+public:
+	explicit MonotonicArena(size_t capacity)
+		: buffer_{ std::make_unique<std::byte[]>(capacity) }
+		, capacity_{ capacity }
 	{
 	}
 
-	bool update(double t) override
+	// 確保したものを全て捨てる（このアリーナのメモリを使うものが残っていてはいけない）
+	void reset()
 	{
-		const double t0_1 = Clamp(t / lifetime_, 0.0, 1.0);
-		const auto pos = pos_ + vel_.fastToVec2() * 8.0 * EaseOutCubic(t0_1);
-		const Color sparkColor = Sample({ Palette::White, Palette::Red, Palette::Gold });
-		RectF{ Arg::center = pos, 0.5 + 6.0 * (1.0 - EaseOutCubic(t0_1)) }.rotated(Math::TwoPi * Random()).draw(sparkColor);
+		peak_ = Max(peak_, used_);
+		used_ = 0;
+	}
 
-		return t < lifetime_;
+	size_t used() const
+	{
+		return used_;
 	}
 
-	double amp_;
-	Vec2 pos_;
-	Circular vel_;
-	double lifetime_;
-};
+	size_t peak() const
+	{
+		return Max(peak_, used_);
+	}
 
-struct ExplodeEffect : IEffect
-{
-public:
-	ExplodeEffect(const Vec2& pos)
-		: pos_{ pos }
+	size_t capacity() const
 	{
+		return capacity_;
 	}
 
-	bool update(double t) override
+	size_t overflowCount() const
 	{
-		const double t0_1 = Clamp(t / 0.6, 0.0, 1.0);
+		return overflows_;
+	}
 
-		Circle{ pos_, 140.0 * EaseOutCubic(t0_1) }.drawFrame(4.0 - 4.0 * t0_1, 0.0, Palette::Whitesmoke);
-		Circle{ pos_, 64.0 * EaseOutCubic(t0_1) }.draw(ColorF{ Palette::Whitesmoke, Periodic::Pulse0_1(0.004s, 0.80 - 0.75 * t0_1)});
+private:
+	void* do_allocate(size_t bytes, size_t alignment) override
+	{
+		const uintptr_t base = reinterpret_cast<uintptr_t>(buffer_.get());
+		const size_t begin = ((base + used_ + alignment - 1) & ~(alignment - 1)) - base;
 
-		for (int i : step(6 - (int)(t0_1 * 4 * Random())))
+		if (capacity_ < begin + bytes)
 		{
-			Circle{ pos_ + Circular{ Random(120 * t0_1), Random() * Math::TwoPi }, Random(5.0, 18.0) * (1.0 - 0.5 * t0_1) }.draw(ColorF{ 1.0, Periodic::Square0_1(0.003s) });
+			++overflows_;
+			return std::pmr::new_delete_resource()->allocate(bytes, alignment);
 		}
 
-		return t < 0.6;
+		used_ = begin + bytes;
+		return buffer_.get() + begin;
 	}
 
-	Vec2 pos_;
+	void do_deallocate(void* p, size_t bytes, size_t alignment) override
+	{
+		// アリーナの中のものは reset() でまとめて捨てる
+		if (owns(p)) return;
+
+		std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+	{
+		return (this == &other);
+	}
+
+	bool owns(const void* p) const
+	{
+		const std::byte* b = static_cast<const std::byte*>(p);
+		return (buffer_.get() <= b) && (b < buffer_.get() + capacity_);
+	}
+
+	std::unique_ptr<std::byte[]> buffer_;
+	size_t capacity_;
+	size_t used_ = 0;
+	size_t peak_ = 0;
+	size_t overflows_ = 0;
 };
 
-class Car
+// 大きさの決まったブロックのプール（メインスレッド専用）
+// 解放されたブロックは空きリストに戻して使い回し、足りなくなったときだけまとめて確保する
+// 最初に使ったスレッドを覚えておき、ほかのスレッドから使われたら空きリストを壊す前に止める
+template <size_t BlockSize>
+class FixedBlockPool
 {
 public:
-	Car(P2World& world, Effect& smokeEffect, Effect& sparkEffect, const Vec2& pos, const Color color, double maxSpeed, Circular enemyVelocity = Circular{}, double delay = 0)
-		:
-		world_{ world },
-		smokeEffect_{ smokeEffect },
-		sparkEffect_{ sparkEffect },
-		color_{ color },
-		maxSpeed_{ maxSpeed },
-		enemyVelocity_{ enemyVelocity },
-		delay_{ delay },
-		time_{ StartImmediately::Yes },
-		timerSmoke_{ 0.1s, StartImmediately::Yes },
-		timerSpark_{ 0.01s, StartImmediately::Yes }
+	static void* Allocate()
 	{
-		constexpr P2Material material{ .density = 1.0, .restitution = 0.5, .friction = 0.5, };
-		body_ = world.createRect(P2Dynamic, pos, BodySize, material, {});
-		body_.setDamping(2.0);
-		body_.setAngularDamping(5.0);
+		FixedBlockPool& pool = Instance();
+		pool.checkThread();
 
-		// タイヤ跡（前輪）
-		for (int iTire : Range(0, 1))
+		if (not pool.free_)
 		{
-			trails_ << TrailMotion{}
-				.setFrequency(30)
-				.setLifeTime(0.2)
-				.setPositionFunction([&, iTire](double) { return tirePos_(iTire); })
-				.setColorFunction([](double) { return Palette::White; })
-				.setAlphaFunction([](double t) { return 0.3 + 0.2 * (1 - t); })
-				.setSizeFunction([](double t) { return 0.8 + 0.4 * EaseOutSine(1 - t) + 3.2 * Periodic::Triangle0_1(0.01s); });
+			pool.grow();
 		}
 
-		// タイヤ跡（後輪）
-		for (int iTire : Range(2, 3))
-		{
-			trails_ << TrailMotion{}
-				.setFrequency(30)
-				.setLifeTime(0.3)
-				.setPositionFunction([&, iTire](double) { return tirePos_(iTire); })
-				.setColorFunction([](double) { return Palette::White; })
-				.setAlphaFunction([](double t) { return 0.8 + 0.2 * (1 - t); })
-				.setSizeFunction([](double t) { return 0.5 + 0.5 * EaseOutSine(1 - t) + 4.5 * Periodic::Triangle0_1(0.01s); });
-		}
+		Node* node = pool.free_;
+		pool.free_ = node->next;
+		return node;
 	}
 
-	void reset(const Vec2& pos)
+	static void Deallocate(void* p)
 	{
-		body_.setVelocity(Vec2::Zero());
-		body_.setPos(pos);
-		body_.setAngularVelocity(0);
-		body_.setAngle(0);
+		FixedBlockPool& pool = Instance();
+		pool.checkThread();
+		Node* node = static_cast<Node*>(p);
+		node->next = pool.free_;
+		pool.free_ = node;
 	}
 
-	void updateAsEnemy(double stepSec, int enemyType)
+private:
+	struct Node
 	{
-		if (life_ <= 0) return;
+		Node* next;
+	};
 
-		if (enemyType == 0)
-		{
-			body_.setAngle(enemyVelocity_.theta);
+	static constexpr size_t Alignment = alignof(std::max_align_t);
+	static constexpr size_t Stride = (Max(BlockSize, sizeof(Node)) + Alignment - 1) / Alignment * Alignment;
+	static constexpr size_t BlocksPerSlab = 256;
 
-			if (time_.sF() > delay_)
-			{
-				body_.setAngle(enemyVelocity_.theta + 15_deg * Periodic::Sine1_1(3s));
-				moveForward(stepSec, enemyVelocity_.r);
-			}
+	static FixedBlockPool& Instance()
+	{
+		static FixedBlockPool pool;
+		return pool;
+	}
+
+	// 解放（operator delete）から呼ばれたときは例外を投げられないので、そのまま std::terminate() になる
+	void checkThread() const
+	{
+		if (std::this_thread::get_id() != owner_)
+		{
+			throw Error{ U"FixedBlockPool: used from a thread other than the main thread" };
 		}
+	}
 
-		// スピードの限界
-		const auto velocity = body_.getVelocity();
-		body_.setVelocity(velocity.limitLength(maxSpeed_));
+	void grow()
+	{
+		slabs_ << std::make_unique<std::byte[]>(Stride * BlocksPerSlab);
+		std::byte* slab = slabs_.back().get();
 
-		// 接触をチェック
-		checkCollision(stepSec, 60.0);
+		for (size_t i = BlocksPerSlab; i > 0; --i)
+		{
+			Node* node = reinterpret_cast<Node*>(slab + Stride * (i - 1));
+			node->next = free_;
+			free_ = node;
+		}
+	}
 
-		// 煙
-		generateSmoke(0.8);
+	Node* free_ = nullptr;
+	Array<std::unique_ptr<std::byte[]>> slabs_;
+	std::thread::id owner_ = std::this_thread::get_id();
+};
 
-		// タイヤ跡
-		updateTireTrail(stepSec);
+// エフェクトをプールから確保する（EffectLayer が StageEffect として delete しても、仮想デストラクタ経由でここに戻る）
+template <class Type>
+struct PooledEffect
+{
+	static void* operator new(size_t)
+	{
+		return FixedBlockPool<sizeof(Type)>::Allocate();
 	}
 
-	void updateAsPlayer(double stepSec, bool paused)
+	static void operator delete(void* p)
 	{
-		if (life_ <= 0) return;
+		FixedBlockPool<sizeof(Type)>::Deallocate(p);
+	}
+};
 
-		if (not paused)
-		{
-			// 前進
-			if (KeyUp.pressed())
-			{
-				moveForward(stepSec, 8000);
-			}
+// フレームごとの一時的な文字列（フレーム用のアリーナに置き、String を作らない）
+using FrameString = std::pmr::u32string;
 
-			// 後退
-			if (KeyDown.pressed())
-			{
-				moveBack(stepSec, 8000);
-			}
+// 0 で埋めて width 桁にする整数
+struct Padded
+{
+	int64 value;
+	int32 width;
+};
 
-			// ハンドルを左に
-			if (KeyLeft.pressed())
-			{
-				turnLeft(stepSec);
-			}
+// 小数点以下 decimals 桁の固定小数点数
+struct Fixed
+{
+	double value;
+	int32 decimals;
+};
 
-			// ハンドルを右に
-			if (KeyRight.pressed())
-			{
-				turnRight(stepSec);
-			}
+inline void AppendPart(FrameString& s, std::u32string_view text)
+{
+	s.append(text);
+}
 
-			// ハンドルが勝手に戻る
-			if (not (KeyLeft | KeyRight).pressed())
-			{
-				freeHandle(stepSec);
-			}
+inline void AppendPart(FrameString& s, const Padded& number)
+{
+	uint64 value = static_cast<uint64>(Abs(number.value));
 
-			// スピードの限界
-			const auto velocity = body_.getVelocity();
-			body_.setVelocity(velocity.limitLength(maxSpeed_));
-		}
+	if (number.value < 0)
+	{
+		s += U'-';
+	}
 
-		// 接触をチェック
-		checkCollision(stepSec, 12.0);
+	char32 digits[20];
+	int32 count = 0;
 
-		// 煙
-		generateSmoke();
+	do
+	{
+		digits[count++] = static_cast<char32>(U'0' + value % 10);
+		value /= 10;
+	} while (value > 0);
 
-		// タイヤ跡
-		updateTireTrail(stepSec);
+	for (int32 i = count; i < number.width; ++i)
+	{
+		s += U'0';
 	}
 
-	void draw() const
+	while (count > 0)
 	{
-		if (life_ <= 0) return;
+		s += digits[--count];
+	}
+}
 
-		// タイヤ跡
-		if (not timerHideTrails_.isRunning())
-		{
-			for (const auto& t : trails_)
-			{
-				t.draw();
-			}
-		}
+template <class Int> requires std::integral<Int>
+inline void AppendPart(FrameString& s, Int value)
+{
+	AppendPart(s, Padded{ static_cast<int64>(value), 1 });
+}
 
-		// タイヤ
+inline void AppendPart(FrameString& s, const Fixed& number)
+{
+	int64 scale = 1;
 
-		const Color tireColor = timerCollided_.isRunning() ? Palette::Red.lerp(Palette::White, Periodic::Square0_1(0.08s)) : Palette::Gray.lerp(color_, 0.5);
-		const Vec2 posVibCollided = timerCollided_.isRunning() ? RandomVec2(Random(0.5, 2.0)) : Vec2::Zero();
-		RectF{ Arg::center = tirePos_(0) + posVibCollided, TireSize }.rotated(angle() + tireAngle_).draw(tireColor);
-		RectF{ Arg::center = tirePos_(1) + posVibCollided, TireSize }.rotated(angle() + tireAngle_).draw(tireColor);
-		RectF{ Arg::center = tirePos_(2) + posVibCollided, TireSize }.rotated(angle()).draw(tireColor);
-		RectF{ Arg::center = tirePos_(3) + posVibCollided, TireSize }.rotated(angle()).draw(tireColor);
+	for (int32 i = 0; i < number.decimals; ++i)
+	{
+		scale *= 10;
+	}
 
-		// 本体
+	const int64 scaled = static_cast<int64>(Math::Round(Abs(number.value) * scale));
 
-		const Vec2 bodyPosVib = Circular{ 1.0 * Periodic::Sine1_1(0.08s), angle() } + RandomVec2(0.5);
-		const Color bodyColor = timerCollided_.isRunning() ? Palette::Red.lerp(Palette::White, 0.5 + 0.5 * Periodic::Square0_1(0.08s)) : color_;
-		const Color damagedBodyColor = life_ >= 70.0 ? bodyColor : bodyColor.lerp(Palette::Red, Periodic::Pulse0_1(SecondsF{ 0.05 + 0.3 * (life_ / 100.0) }, 0.08 + 0.2 * (1.0 - life_ / 100.0)));
-		bodyQuad().movedBy(bodyPosVib + posVibCollided).draw(damagedBodyColor);
+	if (number.value < 0 && scaled != 0)
+	{
+		s += U'-';
 	}
 
-	Quad bodyQuad() const
+	AppendPart(s, Padded{ scaled / scale, 1 });
+
+	if (number.decimals > 0)
 	{
-		return RectF{ Arg::center = pos(), BodySize }.rotated(angle());
+		s += U'.';
+		AppendPart(s, Padded{ scaled % scale, number.decimals });
 	}
+}
 
-	Vec2 pos() const
+// 文字列・整数・Padded・Fixed を順につなげる
+template <class... Args>
+FrameString MakeFrameString(std::pmr::memory_resource* memory, const Args&... args)
+{
+	FrameString s{ memory };
+	(AppendPart(s, args), ...);
+	return s;
+}
+
+// String を作らずに、フォントのグリフを 1 文字ずつ描く（DrawableText::draw() / drawAt() と同じ配置）
+inline void DrawGlyphs(const Font& font, std::u32string_view text, double size, const Vec2& pos, const ColorF& color)
+{
+	const double scale = size / font.fontSize();
+	Vec2 penPos = pos;
+
+	for (const char32 ch : text)
 	{
-		return body_.getPos();
+		const Glyph glyph = font.getGlyph(ch);
+		glyph.texture.scaled(scale).draw(penPos + glyph.getOffset(scale), color);
+		penPos.x += glyph.xAdvance * scale;
 	}
+}
 
-	double angle() const
+// DrawGlyphs() で描いたときの大きさ
+inline SizeF MeasureGlyphs(const Font& font, std::u32string_view text, double size)
+{
+	const double scale = size / font.fontSize();
+	double width = 0;
+
+	for (const char32 ch : text)
 	{
-		return body_.getAngle();
+		width += font.getGlyph(ch).xAdvance * scale;
 	}
 
-	void releaseBody()
+	return SizeF{ width, font.height() * scale };
+}
+
+// HUD の文字列（影付き）をテクスチャに描いておき、内容が変わったときだけ描き直す
+// 文字は白、影は半透明の黒で描いておき、表示するときの色を掛ける
+class HudLabel
+{
+public:
+	// shadowOffset は右下方向（0 なら影なし）
+	HudLabel(const Font& font, double size, const Vec2& shadowOffset = Vec2{ 0, 0 })
+		: font_{ font }
+		, size_{ size }
+		, shadowOffset_{ shadowOffset }
 	{
-		body_.release();
-		alive_ = false;
 	}
 
-	void hideTrails()
+	// 内容を表すキーが前回と違うときだけ文字列を作り直す（同じなら引数は使わない）
+	template <class... Args>
+	void update(int64 key, const Args&... args)
 	{
-		timerHideTrails_.restart(1s);
+		if (key_ == key) return;
+
+		key_ = key;
+		text_.clear();
+		(AppendPart(text_, args), ...);
+		dirty_ = true;
 	}
 
-	void resetLife()
+	void drawAt(const Vec2& center, const ColorF& color = ColorF{ 1.0 })
 	{
-		life_ = 100.0;
+		if (dirty_)
+		{
+			render();
+		}
+
+		texture_(0, 0, regionSize_.x, regionSize_.y).draw(center - textSize_ / 2, color);
 	}
 
-	double life() const
+	// 描き直した回数（統計情報用）
+	static uint64 RenderCount()
 	{
-		return life_;
+		return renderCount_;
 	}
 
-	bool alive() const
+private:
+	void render()
 	{
-		return alive_;
+		dirty_ = false;
+		++renderCount_;
+
+		textSize_ = MeasureGlyphs(font_, text_, size_);
+		regionSize_ = (textSize_ + shadowOffset_).asPoint() + Point{ 1, 1 };
+
+		// テクスチャは大きくなるときだけ作り直す
+		if (texture_.width() < regionSize_.x || texture_.height() < regionSize_.y)
+		{
+			texture_ = RenderTexture{ Size{ Max(texture_.width(), regionSize_.x), Max(texture_.height(), regionSize_.y) }, ColorF{ 0.0, 0.0 } };
+		}
+
+		const ScopedRenderTarget2D target{ texture_.clear(ColorF{ 0.0, 0.0 }) };
+		const ScopedRenderStates2D blend{ BlendState::MaxAlpha };
+		const Transformer2D local{ Mat3x2::Identity(), Transformer2D::Target::SetLocal };
+		const Transformer2D camera{ Mat3x2::Identity(), Transformer2D::Target::SetCamera };
+
+		if (not shadowOffset_.isZero())
+		{
+			DrawGlyphs(font_, text_, size_, shadowOffset_, ColorF{ 0, 0.5 });
+		}
+
+		DrawGlyphs(font_, text_, size_, Vec2{ 0, 0 }, ColorF{ 1.0 });
 	}
 
-private:
-	void moveForward(double stepSec, double force)
+	Font font_;
+	double size_;
+	Vec2 shadowOffset_;
+
+	Optional<int64> key_;
+	FrameString text_;
+	bool dirty_ = false;
+
+	RenderTexture texture_;
+	SizeF textSize_{ 0, 0 };
+	Point regionSize_{ 0, 0 };
+
+	static inline uint64 renderCount_ = 0;
+};
+
+// 描画用の乱数（状態を持たず、オブジェクトの ID とフレームから毎回ハッシュで作る）
+// 同じ ID とフレームなら、何度描いても、どのスレッドで描いても同じ値になる
+struct DrawRandom
+{
+	uint64 id;
+	uint64 frame;
+
+	// splitmix64 の最後の混ぜ合わせ
+	static constexpr uint64 Mix(uint64 x)
 	{
-		const auto forwardVec = Circular{ force, angle() + tireAngle_ }.fastToVec2();
-		body_.applyForceAt(forwardVec * stepSec, pos() + Circular{ 8.0, angle() });
-		body_.setAngularVelocity(tireAngle_ * 3.0);
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+		return x ^ (x >> 31);
 	}
 
-	void moveBack(double stepSec, double force)
+	// salt は 1 回の描画の中で使う乱数ごとに変える
+	constexpr uint64 hash(uint64 salt) const
 	{
-		const auto forwardVec = Circular{ force, angle() + tireAngle_ }.fastToVec2();
-		body_.applyForceAt(-forwardVec * 0.8 * stepSec, pos() + Circular{ 8.0, angle() });
-		body_.setAngularVelocity(-tireAngle_ * 3.0);
+		return Mix(Mix(id * 0x9E3779B97F4A7C15ull + frame) + salt);
 	}
 
-	void turnLeft(double stepSec)
+	// [0, 1)
+	constexpr double unit(uint64 salt) const
 	{
-		tireAngle_ = Clamp(tireAngle_ - 150_deg * stepSec, -45_deg, 45_deg);
+		return (hash(salt) >> 11) * 0x1.0p-53;
 	}
 
-	void turnRight(double stepSec)
+	// [min, max)
+	constexpr double real(uint64 salt, double min, double max) const
 	{
-		tireAngle_ = Clamp(tireAngle_ + 150_deg * stepSec, -45_deg, 45_deg);
+		return min + (max - min) * unit(salt);
 	}
 
-	void freeHandle(double stepSec)
+	// [min, max]
+	constexpr int32 integer(uint64 salt, int32 min, int32 max) const
 	{
-		tireAngle_ = Math::Lerp(tireAngle_, 0, 10.0 * stepSec);
+		return min + static_cast<int32>(hash(salt) % static_cast<uint64>(max - min + 1));
 	}
 
-	void checkCollision(double stepSec, double damage)
+	// 長さ length でランダムな向きのベクトル
+	Vec2 vec2(uint64 salt, double length) const
 	{
-		for (auto&& [pair, collision] : world_.getCollisions())
+		return Circular{ length, Math::TwoPi * unit(salt) }.fastToVec2();
+	}
+};
+
+// エフェクトの発生（数・位置・向き・寿命・次に出すまでの間隔）に使う乱数（splitmix64）
+// シミュレーションのステップの中でだけ引き、状態は 64 ビットだけなので、スナップショットに含めて巻き戻しやリトライでも同じ列に戻す
+namespace EffectRandom
+{
+	constexpr uint64 DefaultSeed = 0x9A3C'1D5E'7B20'F461ull;
+
+	// スレッドごとに持つ（ヘッドレスのシミュレーションを並列に動かしても取り合わない）
+	inline uint64& State()
+	{
+		thread_local uint64 state = DrawRandom::Mix(DefaultSeed);
+		return state;
+	}
+
+	// 1 回の発生につき 1 つ引き、個々の値はそこから DrawRandom で作る
+	inline uint64 Next()
+	{
+		uint64& state = State();
+		state += 0x9E3779B97F4A7C15ull;
+		return DrawRandom::Mix(state);
+	}
+
+	// seed から決まる状態に戻す（ステージの読み込み時など）
+	inline void Reseed(uint64 seed)
+	{
+		State() = DrawRandom::Mix(seed);
+	}
+}
+
+// ステージのエフェクト（時間を進めるのは EffectLayer で、描く側は状態を変えずに経過時間 t だけから描く）
+struct StageEffect
+{
+	virtual ~StageEffect() = default;
+
+	// 出てから消えるまでの時間
+	virtual double lifetime() const = 0;
+
+	// 描く範囲（画面ごとに、映らないものを描かずに済ませる）
+	virtual RectF bounds() const = 0;
+
+	virtual void draw(double t) const = 0;
+};
+
+// エフェクトの一覧
+// 時間を進めて寿命の尽きたものを取り除くのは update() で 1 フレームに 1 回、描くのは draw() で画面ごとに何度でもよい
+class EffectLayer
+{
+public:
+	template <class Type, class... Args>
+	void add(Args&&... args)
+	{
+		effects_ << Entry{ std::make_unique<Type>(std::forward<Args>(args)...), 0.0 };
+	}
+
+	// 前のフレームまでに出たものの時間を進める（そのフレームのシミュレーションより前に呼び、新しく出たものは t = 0 から描く）
+	void update(double deltaSec)
+	{
+		for (auto& entry : effects_)
+		{
+			entry.t += deltaSec;
+		}
+
+		effects_.remove_if([](const Entry& entry) { return entry.effect->lifetime() <= entry.t; });
+	}
+
+	// view: 画面に映る範囲（ワールド座標）
+	void draw(const RectF& view) const
+	{
+		for (const auto& entry : effects_)
+		{
+			if (entry.effect->bounds().intersects(view))
+			{
+				entry.effect->draw(entry.t);
+			}
+		}
+	}
+
+	void clear()
+	{
+		effects_.clear();
+	}
+
+private:
+	struct Entry
+	{
+		std::unique_ptr<StageEffect> effect;
+		double t;
+	};
+
+	Array<Entry> effects_;
+};
+
+struct SmokeEffect : StageEffect, PooledEffect<SmokeEffect>
+{
+	// seed: EffectRandom::Next() から作った値（位置・向き・速さのばらつきをここから決める）
+	SmokeEffect(const Vec2& pos, double forwardAngle, double scale, uint64 seed)
+		:
+		pos_{ pos + DrawRandom{ seed, 0 }.vec2(0, 2.0) },
+		forwardAngle_{ forwardAngle + DrawRandom{ seed, 0 }.real(1, -30_deg, 30_deg) },
+		scale_{ scale },
+		speed_{ DrawRandom{ seed, 0 }.real(2, 0.08, 0.5 + 1.0 * scale) * 60.0 }
+	{
+	}
+
+	double lifetime() const override
+	{
+		return 0.2 * scale_;
+	}
+
+	RectF bounds() const override
+	{
+		return RectF{ Arg::center = pos_, (speed_ * lifetime() + 11.0 * scale_) * 2 };
+	}
+
+	void draw(double t) const override
+	{
+		const double t0_1 = t / lifetime();
+		const Vec2 pos = pos_ + Circular{ speed_ * t, forwardAngle_ + 180_deg };
+
+		Circle{ pos, (2.0 + 6.0 * t0_1) * scale_ }
+			.draw(ColorF{ 1.0, 1.0 - EaseInCubic(t0_1) })
+			.drawFrame((3.0 * (1.0 - t0_1)) * scale_, 0.0, ColorF{ 1.0, 1.0 - 0.5 * (t0_1) });
+	}
+
+	Vec2 pos_;
+	double forwardAngle_;
+	double scale_;
+
+	// 後ろへ流れる速さ（ピクセル毎秒。元は 60 fps での 1 フレームあたりの移動量だったので、それを秒あたりに直した値）
+	double speed_;
+};
+
+struct SparkEffect : StageEffect, PooledEffect<SparkEffect>
+{
+	SparkEffect(const Vec2& pos, double speed, uint64 seed)
+		:
+		amp_{ Clamp(EaseOutCubic(speed / 700.0), 0.1, 1.0) },
+		pos_{ pos + DrawRandom{ seed, 0 }.vec2(0, DrawRandom{ seed, 0 }.real(1, 0.0, 4.0)) },
+		vel_{ DrawRandom{ seed, 0 }.real(2, 1.0, 8.0) * amp_, Math::TwoPi * DrawRandom{ seed, 0 }.unit(3) },
+		lifetime_{ (0.3 + DrawRandom{ seed, 0 }.real(4, -0.1, 0.1)) * amp_ },
+		id_{ DrawRandom{ seed, 0 }.hash(5) }
+	{
+	}
+
+	double lifetime() const override
+	{
+		return lifetime_;
+	}
+
+	RectF bounds() const override
+	{
+		return RectF{ Arg::center = pos_, (vel_.r * 8.0 + 5.0) * 2 };
+	}
+
+	void draw(double t) const override
+	{
+		const double t0_1 = Clamp(t / lifetime_, 0.0, 1.0);
+		const auto pos = pos_ + vel_.fastToVec2() * 8.0 * EaseOutCubic(t0_1);
+
+		// 色と向きは毎フレーム変わる（経過時間をシミュレーションのステップ数にしたものをフレームとする）
+		constexpr std::array<Color, 3> SparkColors{ Palette::White, Palette::Red, Palette::Gold };
+		const DrawRandom random{ id_, static_cast<uint64>(t / StepSec) };
+		const Color sparkColor = SparkColors[random.integer(0, 0, 2)];
+		RectF{ Arg::center = pos, 0.5 + 6.0 * (1.0 - EaseOutCubic(t0_1)) }.rotated(Math::TwoPi * random.unit(1)).draw(sparkColor);
+	}
+
+	double amp_;
+	Vec2 pos_;
+	Circular vel_;
+	double lifetime_;
+	uint64 id_;
+};
+
+struct ExplodeEffect : StageEffect, PooledEffect<ExplodeEffect>
+{
+public:
+	ExplodeEffect(const Vec2& pos, uint64 seed)
+		: pos_{ pos }
+		, id_{ seed }
+	{
+	}
+
+	double lifetime() const override
+	{
+		return 0.6;
+	}
+
+	RectF bounds() const override
+	{
+		return RectF{ Arg::center = pos_, 144.0 * 2 };
+	}
+
+	void draw(double t) const override
+	{
+		const double t0_1 = Clamp(t / 0.6, 0.0, 1.0);
+
+		Circle{ pos_, 140.0 * EaseOutCubic(t0_1) }.drawFrame(4.0 - 4.0 * t0_1, 0.0, Palette::Whitesmoke);
+		Circle{ pos_, 64.0 * EaseOutCubic(t0_1) }.draw(ColorF{ Palette::Whitesmoke, Periodic::Pulse0_1(0.004s, 0.80 - 0.75 * t0_1)});
+
+		const DrawRandom random{ id_, static_cast<uint64>(t / StepSec) };
+
+		for (int i : step(6 - (int)(t0_1 * 4 * random.unit(0))))
+		{
+			const uint64 salt = 1 + 3 * i;
+			Circle{ pos_ + Circular{ random.real(salt, 0.0, 120 * t0_1), random.unit(salt + 1) * Math::TwoPi }, random.real(salt + 2, 5.0, 18.0) * (1.0 - 0.5 * t0_1) }.draw(ColorF{ 1.0, Periodic::Square0_1(0.003s) });
+		}
+	}
+
+	Vec2 pos_;
+	uint64 id_;
+};
+
+// 運転操作の入力状態
+struct InputState
+{
+	bool up = false;
+	bool down = false;
+	bool left = false;
+	bool right = false;
+
+	bool operator==(const InputState&) const = default;
+
+	// 上・下・左・右を下位 4 ビットに詰める（学習環境の行動や、入力列のファイルの形式）
+	uint8 toBits() const
+	{
+		return static_cast<uint8>(up | (down << 1) | (left << 2) | (right << 3));
+	}
+
+	static InputState FromBits(uint8 bits)
+	{
+		return InputState{ (bits & 1) != 0, (bits & 2) != 0, (bits & 4) != 0, (bits & 8) != 0 };
+	}
+};
+
+// プレイヤーごとの操作キー
+struct PlayerKeys
+{
+	Input up;
+	Input down;
+	Input left;
+	Input right;
+	Input zoomOut;
+
+	// pressed: キーが押されているか
+	template <class Pressed>
+	InputState state(Pressed pressed) const
+	{
+		return InputState{ pressed(up), pressed(down), pressed(left), pressed(right) };
+	}
+};
+
+// 1 人で遊ぶときの操作キー
+inline constexpr PlayerKeys SinglePlayerKeys{ KeyUp, KeyDown, KeyLeft, KeyRight, KeySpace };
+
+// 分割画面の 1P～4P の操作キー
+inline constexpr std::array<PlayerKeys, 4> SplitScreenKeys{
+	PlayerKeys{ KeyUp, KeyDown, KeyLeft, KeyRight, KeyRShift },
+	PlayerKeys{ KeyW, KeyS, KeyA, KeyD, KeyLShift },
+	PlayerKeys{ KeyI, KeyK, KeyJ, KeyL, KeySpace },
+	PlayerKeys{ KeyNum8, KeyNum5, KeyNum4, KeyNum6, KeyNum0 },
+};
+
+// 入力状態の変化（Time::GetMicrosec() 基準の時刻つき）
+struct InputEvent
+{
+	uint64 timeUs;
+	InputState state;
+
+	// 何人目のプレイヤーの入力か
+	int32 player = 0;
+};
+
+// 運転操作のキーをフレームとは独立にサンプリングし、変化した時刻とともに記録する
+// 分割画面では、プレイヤーごとのキーをまとめてサンプリングする
+// Windows 以外ではフレームごとのサンプリングになる
+class InputSampler
+{
+public:
+	explicit InputSampler(std::span<const PlayerKeys> keys = std::span{ &SinglePlayerKeys, 1 })
+		: keys_(keys.begin(), keys.end())
+		, last_(keys.size())
+	{
+# if SIV3D_PLATFORM(WINDOWS)
+		thread_ = std::jthread{ [this](std::stop_token stopToken) { run(stopToken); } };
+# endif
+	}
+
+	// 前回の呼び出し以降の入力の変化を取り出す（毎フレーム、System::Update() の後に呼ぶ）
+	void collect(Array<InputEvent>& events)
+	{
+		const bool focused = Window::GetState().focused;
+
+# if SIV3D_PLATFORM(WINDOWS)
+		enabled_ = focused;
+# else
+		sample(focused, [](const Input& key) { return key.pressed(); });
+# endif
+
+		std::lock_guard lock{ mutex_ };
+		events.append(pending_);
+		pending_.clear();
+	}
+
+private:
+	// ウィンドウが非アクティブのときは全て離したものとする
+	template <class Pressed>
+	void sample(bool enabled, Pressed pressed)
+	{
+		for (auto [i, keys] : Indexed(keys_))
+		{
+			record(static_cast<int32>(i), enabled ? keys.state(pressed) : InputState{});
+		}
+	}
+
+	void record(int32 player, const InputState& state)
+	{
+		if (state == last_[player]) return;
+
+		last_[player] = state;
+
+		std::lock_guard lock{ mutex_ };
+		pending_ << InputEvent{ Time::GetMicrosec(), state, player };
+	}
+
+# if SIV3D_PLATFORM(WINDOWS)
+	static bool IsAsyncKeyPressed(const Input& key)
+	{
+		return (GetAsyncKeyState(key.code()) & 0x8000) != 0;
+	}
+
+	void run(std::stop_token stopToken)
+	{
+		timeBeginPeriod(1);
+
+		while (not stopToken.stop_requested())
+		{
+			sample(enabled_, IsAsyncKeyPressed);
+
+			std::this_thread::sleep_for(std::chrono::microseconds{ 500 });
+		}
+
+		timeEndPeriod(1);
+	}
+
+# endif
+
+	// サンプリングするスレッドからは読むだけ
+	const Array<PlayerKeys> keys_;
+
+	std::mutex mutex_;
+	Array<InputEvent> pending_;
+	Array<InputState> last_;
+
+# if SIV3D_PLATFORM(WINDOWS)
+	// スレッドが使うものより後に置き、先に止まるようにする
+	std::atomic<bool> enabled_ = false;
+	std::jthread thread_;
+# endif
+};
+
+// 入力から表示までの遅延の計測
+class InputLatencyMeter
+{
+public:
+	// 入力がシミュレーションに反映された
+	void applied(uint64 eventTimeUs)
+	{
+		applied_ << eventTimeUs;
+	}
+
+	// フレームが表示された（System::Update() の直後に呼ぶ）
+	void presented(uint64 nowUs)
+	{
+		for (const auto eventTimeUs : applied_)
+		{
+			lastMs_ = (nowUs - eventTimeUs) / 1000.0;
+			averageMs_ = (averageMs_ == 0) ? lastMs_ : Math::Lerp(averageMs_, lastMs_, 0.1);
+		}
+
+		applied_.clear();
+	}
+
+	double lastMs() const
+	{
+		return lastMs_;
+	}
+
+	double averageMs() const
+	{
+		return averageMs_;
+	}
+
+private:
+	Array<uint64> applied_;
+	double lastMs_ = 0;
+	double averageMs_ = 0;
+};
+
+// タイムスタンプ付きの入力を物理演算のサブステップへ振り分ける（プレイヤーごとに 1 つ）
+class InputTimeline
+{
+public:
+	// player の入力だけを取り込む
+	void push(const Array<InputEvent>& events, int32 player = 0)
+	{
+		for (const auto& e : events)
+		{
+			if (e.player == player)
+			{
+				events_ << e;
+			}
+		}
+	}
+
+	// 時刻 timeUs までに起きた入力を反映した状態を返す
+	const InputState& advanceTo(uint64 timeUs, InputLatencyMeter& latency)
+	{
+		while (head_ < events_.size() && events_[head_].timeUs <= timeUs)
+		{
+			state_ = events_[head_].state;
+			latency.applied(events_[head_].timeUs);
+			++head_;
+		}
+
+		if (head_ == events_.size())
+		{
+			events_.clear();
+			head_ = 0;
+		}
+
+		return state_;
+	}
+
+	const InputState& state() const
+	{
+		return state_;
+	}
+
+private:
+	Array<InputEvent> events_;
+	size_t head_ = 0;
+	InputState state_;
+};
+
+// vsync を切り、目標フレームレートに合わせて精密に待機する
+// targetFPS が 0 のときは vsync に任せる
+class FramePacer
+{
+public:
+	explicit FramePacer(double targetFPS)
+		: periodUs_{ (targetFPS > 0) ? static_cast<uint64>(1'000'000 / targetFPS) : 0 }
+	{
+		if (periodUs_ > 0)
+		{
+			Graphics::SetVSyncEnabled(false);
+		}
+	}
+
+	// 毎フレーム、System::Update() の直後（ループの先頭）で、入力を取り込む前に呼ぶ
+	void wait()
+	{
+		if (periodUs_ == 0) return;
+
+		uint64 nowUs = Time::GetMicrosec();
+
+		while (nowUs < nextUs_)
+		{
+			// 残り 2ms まではスリープし、それ以降はスピンする
+			const uint64 remainingUs = nextUs_ - nowUs;
+
+			if (remainingUs > 2000)
+			{
+				std::this_thread::sleep_for(std::chrono::microseconds{ remainingUs - 2000 });
+			}
+			else
+			{
+				std::this_thread::yield();
+			}
+
+			nowUs = Time::GetMicrosec();
+		}
+
+		// 大きく遅れたときは追いつこうとせず、今から数え直す
+		nextUs_ = (nowUs - nextUs_ > periodUs_) ? (nowUs + periodUs_) : (nextUs_ + periodUs_);
+	}
+
+private:
+	uint64 periodUs_;
+	uint64 nextUs_ = 0;
+};
+
+// ステージの定義ファイルのホットリロード 1 回分の結果
+struct StageReloadResult
+{
+	double ms = 0;
+	size_t wallsAdded = 0;
+	size_t wallsMoved = 0;
+	size_t wallsRemoved = 0;
+	size_t enemiesChanged = 0;
+
+	// 敵の数の上限（MaxEnemies）を超えて作らなかった敵の数
+	size_t enemiesDropped = 0;
+};
+
+// デバッグ用の統計情報（F1 キーで表示切り替え）
+struct DebugStats
+{
+	bool visible = false;
+	double inputLatencyMs = 0;
+	double inputLatencyAverageMs = 0;
+	size_t loadedChunks = 0;
+	size_t totalChunks = 0;
+	size_t visibleWalls = 0;
+	size_t wallBodies = 0;
+	std::array<size_t, 4> carLods{};
+	size_t historyBytes = 0;
+	double historySec = 0;
+	size_t contacts = 0;
+	uint64 heapAllocations = 0;
+	size_t frameArenaBytes = 0;
+	size_t stageArenaBytes = 0;
+	uint64 hudRenders = 0;
+	StageReloadResult reload;
+
+	// 行の文字列は frameMemory（フレーム用のアリーナ）に置く
+	void draw(const Font& font, std::pmr::memory_resource* frameMemory) const
+	{
+		if (not visible) return;
+
+		const std::array<FrameString, 10> lines = {
+			MakeFrameString(frameMemory, U"FPS ", Profiler::FPS()),
+			MakeFrameString(frameMemory, U"INPUT LAT ", Fixed{ inputLatencyMs, 1 }, U"ms (AVG ", Fixed{ inputLatencyAverageMs, 1 }, U"ms)"),
+			MakeFrameString(frameMemory, U"CHUNKS ", loadedChunks, U"/", totalChunks, U" WALLS ", visibleWalls, U"/", wallBodies),
+			MakeFrameString(frameMemory, U"CAR LOD ", carLods[0], U"/", carLods[1], U"/", carLods[2], U"/", carLods[3]),
+			MakeFrameString(frameMemory, U"HISTORY ", Fixed{ historyBytes / (1024.0 * 1024.0), 2 }, U"MB ", Fixed{ historySec, 1 }, U"s"),
+			MakeFrameString(frameMemory, U"CONTACTS ", contacts),
+			MakeFrameString(frameMemory, U"HEAP ALLOCS ", heapAllocations, U"/FRAME"),
+			MakeFrameString(frameMemory, U"ARENA FRAME ", frameArenaBytes, U"B STAGE ", stageArenaBytes, U"B"),
+			MakeFrameString(frameMemory, U"HUD REDRAWS ", hudRenders, U"/FRAME"),
+			MakeFrameString(frameMemory, U"RELOAD ", Fixed{ reload.ms, 2 }, U"ms WALL +", reload.wallsAdded, U" ~", reload.wallsMoved, U" -", reload.wallsRemoved, U" ENEMY ", reload.enemiesChanged, U" DROP ", reload.enemiesDropped),
+		};
+
+		RectF{ 0, 0, Scene::Width(), 8.0 + 14.0 * lines.size() }.draw(ColorF{ 0, 0.6 });
+
+		for (auto [i, line] : Indexed(lines))
+		{
+			DrawGlyphs(font, line, 12, Vec2{ 4, 4.0 + 14.0 * i }, Palette::Lime);
+		}
+	}
+};
+
+// 車の描画とエフェクトの詳細度（画面上での大きさと位置で決める）
+enum class CarLod
+{
+	// タイヤ・振動・タイヤ跡まで全て描く
+	Full,
+
+	// 本体の四角形だけを描く
+	Simple,
+
+	// 本体の四角形だけを描き、煙・火花・タイヤ跡を出さない
+	Minimal,
+
+	// 画面外なので何も描かず、煙・火花・タイヤ跡も出さない（壊れたときの爆発は出す）
+	Culled,
+};
+
+// 車の詳細度を求める
+// screenDistance: 画面中心からの距離（レンダーテクスチャ上のピクセル数）
+// projectedSize: 車体の長辺の画面上での大きさ（ピクセル数）
+CarLod ChooseCarLod(double screenDistance, double projectedSize)
+{
+	// 画面の対角の半分に車体の大きさを加えた範囲の外は見えない
+	if (screenDistance > SceneWidth * Math::Sqrt2 / 2 + projectedSize)
+	{
+		return CarLod::Culled;
+	}
+
+	if (screenDistance > 100)
+	{
+		return CarLod::Minimal;
+	}
+
+	if (screenDistance > 48 || projectedSize < 22)
+	{
+		return CarLod::Simple;
+	}
+
+	return CarLod::Full;
+}
+
+// 当たり判定のカテゴリ（剛体の種類ごとのビット）
+// ゴールは剛体を持たず、車体の四角形が収まっているかで判定するので含めない
+namespace CollisionCategory
+{
+	constexpr uint16 Player = 0x0001;
+	constexpr uint16 Enemy = 0x0002;
+	constexpr uint16 Wall = 0x0004;
+}
+
+// 剛体の種類ごとの、ぶつかる相手のカテゴリ（ステージごとに決める）
+// 互いのマスクが相手のカテゴリを含む組だけが、ブロードフェーズで接触の候補になる
+// 既定ではゲームに影響しない組（分割画面のプレイヤーどうし、動かない壁どうし）だけを除く
+// 動かない壁どうしは Box2D が最初から除くので、1 人用の組み込みのステージで減る組はない（ステージの定義ファイルで変えるための設定）
+// 敵どうしの接触はダメージと爆発になるので、組み込みのステージでは除かない
+struct CollisionRules
+{
+	uint16 playerMask = CollisionCategory::Enemy | CollisionCategory::Wall;
+	uint16 enemyMask = CollisionCategory::Player | CollisionCategory::Enemy | CollisionCategory::Wall;
+	uint16 wallMask = CollisionCategory::Player | CollisionCategory::Enemy;
+
+	bool operator==(const CollisionRules&) const = default;
+
+	P2Filter playerFilter() const
+	{
+		return P2Filter{ .categoryBits = CollisionCategory::Player, .maskBits = playerMask };
+	}
+
+	P2Filter enemyFilter() const
+	{
+		return P2Filter{ .categoryBits = CollisionCategory::Enemy, .maskBits = enemyMask };
+	}
+
+	P2Filter wallFilter() const
+	{
+		return P2Filter{ .categoryBits = CollisionCategory::Wall, .maskBits = wallMask };
+	}
+};
+
+// 車の姿勢（位置と向き、その sin/cos と、そこから求めた車体の四隅とタイヤの位置）
+// 1 ティックに 1 回まとめて求めておき、ゲームの処理と描画はここから読む
+struct CarPose
+{
+	Vec2 pos{ 0, 0 };
+	double angle = 0;
+	double sinAngle = 0;
+	double cosAngle = 1;
+
+	// 前輪の向き（車体の向き + タイヤの向き）の sin/cos（前輪で進むときに力を加える向き）
+	double sinSteer = 0;
+	double cosSteer = 1;
+
+	// 車体の四隅
+	Quad body;
+
+	// タイヤの位置（0-3、時計回り）
+	std::array<Vec2, 4> tires;
+
+	// 車の向きに回したベクトル（rotate(Circular{ r, θ }) は Circular{ r, angle + θ }）
+	Vec2 rotate(const Vec2& v) const
+	{
+		return Vec2{ v.x * cosAngle - v.y * sinAngle, v.x * sinAngle + v.y * cosAngle };
+	}
+
+	// 前方向に distance のベクトル（Circular{ distance, angle }）
+	Vec2 forward(double distance) const
+	{
+		return Vec2{ distance * sinAngle, -distance * cosAngle };
+	}
+
+	// 車の向きに合わせて回した長方形（RectF::rotated() と同じ頂点の順）
+	Quad rotatedRect(const Vec2& center, const SizeF& size) const
+	{
+		const Vec2 x = rotate(Vec2{ size.x / 2, 0 });
+		const Vec2 y = rotate(Vec2{ 0, size.y / 2 });
+		return Quad{ center - x - y, center + x - y, center + x + y, center - x + y };
+	}
+
+	// 前輪の向きに合わせて回した長方形
+	Quad steeredRect(const Vec2& center, const SizeF& size) const
+	{
+		const Vec2 x{ size.x / 2 * cosSteer, size.x / 2 * sinSteer };
+		const Vec2 y{ -size.y / 2 * sinSteer, size.y / 2 * cosSteer };
+		return Quad{ center - x - y, center + x - y, center + x + y, center - x + y };
+	}
+};
+
+class Car
+{
+public:
+	Car(P2World& world, EffectLayer& smokeEffect, EffectLayer& sparkEffect, const Vec2& pos, const Color color, double maxSpeed, Circular enemyVelocity = Circular{}, double delay = 0)
+		:
+		world_{ world },
+		smokeEffect_{ smokeEffect },
+		sparkEffect_{ sparkEffect },
+		color_{ color },
+		maxSpeed_{ maxSpeed },
+		enemyVelocity_{ enemyVelocity },
+		delay_{ delay }
+	{
+		createBody(pos);
+
+		// タイヤ跡（前輪）
+		for (int iTire : Range(0, 1))
+		{
+			trails_[iTire] = TrailMotion{}
+				.setFrequency(30)
+				.setLifeTime(0.2)
+				.setPositionFunction([&, iTire](double) { return tirePos_(iTire); })
+				.setColorFunction([](double) { return Palette::White; })
+				.setAlphaFunction([](double t) { return 0.3 + 0.2 * (1 - t); })
+				.setSizeFunction([](double t) { return 0.8 + 0.4 * EaseOutSine(1 - t) + 3.2 * Periodic::Triangle0_1(0.01s); });
+		}
+
+		// タイヤ跡（後輪）
+		for (int iTire : Range(2, 3))
+		{
+			trails_[iTire] = TrailMotion{}
+				.setFrequency(30)
+				.setLifeTime(TrailLifeTime)
+				.setPositionFunction([&, iTire](double) { return tirePos_(iTire); })
+				.setColorFunction([](double) { return Palette::White; })
+				.setAlphaFunction([](double t) { return 0.8 + 0.2 * (1 - t); })
+				.setSizeFunction([](double t) { return 0.5 + 0.5 * EaseOutSine(1 - t) + 4.5 * Periodic::Triangle0_1(0.01s); });
+		}
+	}
+
+	void reset(const Vec2& pos)
+	{
+		body_.setVelocity(Vec2::Zero());
+		body_.setPos(pos);
+		body_.setAngularVelocity(0);
+		body_.setAngle(0);
+		tireAngle_ = 0;
+		updatePose();
+	}
+
+	void updateAsEnemy(double stepSec, int enemyType)
+	{
+		if (life_ <= 0) return;
+
+		++elapsedSteps_;
+
+		const double elapsedSec = elapsedSteps_ * stepSec;
+
+		if (enemyType == 0)
+		{
+			body_.setAngle(enemyVelocity_.theta);
+
+			if (elapsedSec > delay_)
+			{
+				body_.setAngle(enemyVelocity_.theta + 15_deg * Periodic::Sine1_1(3s, elapsedSec));
+
+				// 向きを直接変えたので、この車だけ姿勢を求め直す
+				updatePose();
+				moveForward(stepSec, enemyVelocity_.r);
+			}
+		}
+
+		// スピードの限界
+		const auto velocity = body_.getVelocity();
+		body_.setVelocity(velocity.limitLength(maxSpeed_));
+
+		// 接触をチェック
+		checkCollision(stepSec, 60.0);
+
+		// 煙
+		generateSmoke(stepSec, 0.8);
+
+		// タイヤ跡
+		updateTireTrail(stepSec);
+	}
+
+	void updateAsPlayer(double stepSec, const InputState& input, bool paused)
+	{
+		if (life_ <= 0) return;
+
+		if (not paused)
+		{
+			// 前進
+			if (input.up)
+			{
+				moveForward(stepSec, 8000);
+			}
+
+			// 後退
+			if (input.down)
+			{
+				moveBack(stepSec, 8000);
+			}
+
+			// ハンドルを左に
+			if (input.left)
+			{
+				turnLeft(stepSec);
+			}
+
+			// ハンドルを右に
+			if (input.right)
+			{
+				turnRight(stepSec);
+			}
+
+			// ハンドルが勝手に戻る
+			if (not (input.left || input.right))
+			{
+				freeHandle(stepSec);
+			}
+
+			// スピードの限界
+			const auto velocity = body_.getVelocity();
+			body_.setVelocity(velocity.limitLength(maxSpeed_));
+		}
+
+		// 接触をチェック
+		checkCollision(stepSec, 12.0);
+
+		// 煙
+		generateSmoke(stepSec);
+
+		// タイヤ跡
+		updateTireTrail(stepSec);
+	}
+
+	// frame: 振動などの描画用の乱数に使う（シミュレーションのステップ数を渡すと、リプレイでも同じ見た目になる）
+	void draw(uint64 frame) const
+	{
+		if (life_ <= 0) return;
+
+		if (lod_ == CarLod::Culled) return;
+
+		// 遠くの車は本体の四角形だけ
+		if (lod_ != CarLod::Full)
+		{
+			const Color bodyColor = collided() ? Palette::Red : color_;
+			bodyQuad().draw(bodyColor);
+			return;
+		}
+
+		// タイヤ跡
+		if (not timerHideTrails_.isRunning())
+		{
+			for (const auto& t : trails_)
+			{
+				t.draw();
+			}
+		}
+
+		// タイヤ
+
+		const Color tireColor = collided() ? Palette::Red.lerp(Palette::White, Periodic::Square0_1(0.08s)) : Palette::Gray.lerp(color_, 0.5);
+		const DrawRandom random{ drawId_, frame };
+		const Vec2 posVibCollided = collided() ? random.vec2(0, random.real(1, 0.5, 2.0)) : Vec2::Zero();
+		pose_.steeredRect(tirePos_(0) + posVibCollided, TireSize).draw(tireColor);
+		pose_.steeredRect(tirePos_(1) + posVibCollided, TireSize).draw(tireColor);
+		pose_.rotatedRect(tirePos_(2) + posVibCollided, TireSize).draw(tireColor);
+		pose_.rotatedRect(tirePos_(3) + posVibCollided, TireSize).draw(tireColor);
+
+		// 本体
+
+		const Vec2 bodyPosVib = pose_.forward(1.0 * Periodic::Sine1_1(0.08s)) + random.vec2(2, 0.5);
+		const Color bodyColor = collided() ? Palette::Red.lerp(Palette::White, 0.5 + 0.5 * Periodic::Square0_1(0.08s)) : color_;
+		const Color damagedBodyColor = life_ >= 70.0 ? bodyColor : bodyColor.lerp(Palette::Red, Periodic::Pulse0_1(SecondsF{ 0.05 + 0.3 * (life_ / 100.0) }, 0.08 + 0.2 * (1.0 - life_ / 100.0)));
+		bodyQuad().movedBy(bodyPosVib + posVibCollided).draw(damagedBodyColor);
+	}
+
+	Quad bodyQuad() const
+	{
+		return pose_.body;
+	}
+
+	Vec2 pos() const
+	{
+		return pose_.pos;
+	}
+
+	double angle() const
+	{
+		return pose_.angle;
+	}
+
+	const CarPose& pose() const
+	{
+		return pose_;
+	}
+
+	// 当たり判定のフィルタ（壊れた後に剛体を作り直すときにも使う）
+	void setCollisionFilter(const P2Filter& filter)
+	{
+		filter_ = filter;
+
+		if (alive_)
+		{
+			body_.shape(0).setFilter(filter_);
+		}
+	}
+
+	// 全ての車の姿勢をまとめて更新する（物理演算のワールドを進めた後に 1 回）
+	// 剛体から向きを連続した配列に集めて sin/cos をまとめて計算し（コンパイラがベクトル化できる形）、車体の四隅とタイヤの位置を求める
+	// 向きが前の姿勢から変わっていない車（まっすぐ走る敵など）は前の sin/cos をそのまま使い、ハンドルを切っている車だけ前輪の向きも求める
+	static void UpdatePoses(std::span<Car> players, Array<Car>& enemies)
+	{
+		// 車ごとの、angles の中での車体の向きと前輪の向きの位置（NoAngle なら前の値・車体の向きをそのまま使う）
+		struct Entry
+		{
+			Car* car;
+			uint32 body;
+			uint32 steer;
+		};
+
+		constexpr uint32 NoAngle = Largest<uint32>;
+
+		thread_local Array<Entry> entries;
+		thread_local Array<double> angles;
+		thread_local Array<double> sins;
+		thread_local Array<double> coss;
+
+		entries.clear();
+		angles.clear();
+
+		const auto add = [&](Car& car)
+			{
+				if (not car.alive_) return;
+
+				const double angle = car.body_.getAngle();
+				Entry entry{ &car, NoAngle, NoAngle };
+
+				if (angle != car.pose_.angle)
+				{
+					entry.body = static_cast<uint32>(angles.size());
+					angles << angle;
+				}
+
+				if (car.tireAngle_ != 0)
+				{
+					entry.steer = static_cast<uint32>(angles.size());
+					angles << angle + car.tireAngle_;
+				}
+
+				entries << entry;
+			};
+
+		for (auto& player : players)
+		{
+			add(player);
+		}
+
+		for (auto& e : enemies)
+		{
+			add(e);
+		}
+
+		const size_t count = angles.size();
+		sins.resize(count);
+		coss.resize(count);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			sins[i] = std::sin(angles[i]);
+			coss[i] = std::cos(angles[i]);
+		}
+
+		for (const auto& entry : entries)
+		{
+			Car& car = *entry.car;
+			const CarPose& prev = car.pose_;
+			const double angle = (entry.body != NoAngle) ? angles[entry.body] : prev.angle;
+			const double sinAngle = (entry.body != NoAngle) ? sins[entry.body] : prev.sinAngle;
+			const double cosAngle = (entry.body != NoAngle) ? coss[entry.body] : prev.cosAngle;
+			const double sinSteer = (entry.steer != NoAngle) ? sins[entry.steer] : sinAngle;
+			const double cosSteer = (entry.steer != NoAngle) ? coss[entry.steer] : cosAngle;
+			car.pose_ = MakePose(car.body_.getPos(), angle, sinAngle, cosAngle, sinSteer, cosSteer);
+		}
+	}
+
+	Vec2 velocity() const
+	{
+		return body_.getVelocity();
+	}
+
+	double tireAngle() const
+	{
+		return tireAngle_;
+	}
+
+	double maxSpeed() const
+	{
+		return maxSpeed_;
+	}
+
+	double angularVelocity() const
+	{
+		return body_.getAngularVelocity();
+	}
+
+	bool collided() const
+	{
+		return collidedSec_ > 0;
+	}
+
+	// スナップショット用の状態
+	struct State
+	{
+		Vec2 pos;
+		double angle;
+		Vec2 velocity;
+		double angularVelocity;
+		double life;
+		double tireAngle;
+		int32 elapsedSteps;
+		double collidedSec;
+		bool alive;
+		double smokeCooldownSec = SmokeIntervalSec;
+		double sparkCooldownSec = 0;
+	};
+
+	State state() const
+	{
+		State s{
+			.life = life_,
+			.tireAngle = tireAngle_,
+			.elapsedSteps = elapsedSteps_,
+			.collidedSec = collidedSec_,
+			.alive = alive_,
+			.smokeCooldownSec = smokeCooldownSec_,
+			.sparkCooldownSec = sparkCooldownSec_,
+		};
+
+		if (alive_)
+		{
+			s.pos = body_.getPos();
+			s.angle = body_.getAngle();
+			s.velocity = body_.getVelocity();
+			s.angularVelocity = body_.getAngularVelocity();
+		}
+
+		return s;
+	}
+
+	// 剛体を作り直さずにその場で状態を戻す（壊れて解放済みの車だけは剛体を作り直す）
+	void restore(const State& s)
+	{
+		// 前輪の向きの sin/cos も姿勢と一緒に求めるので、先に戻しておく
+		tireAngle_ = s.tireAngle;
+
+		if (s.alive && not alive_)
+		{
+			createBody(s.pos);
+		}
+		else if (not s.alive && alive_)
+		{
+			releaseBody();
+		}
+
+		if (s.alive)
+		{
+			body_.setPos(s.pos);
+			body_.setAngle(s.angle);
+			body_.setVelocity(s.velocity);
+			body_.setAngularVelocity(s.angularVelocity);
+			updatePose();
+		}
+
+		life_ = s.life;
+		elapsedSteps_ = s.elapsedSteps;
+		collidedSec_ = s.collidedSec;
+		smokeCooldownSec_ = s.smokeCooldownSec;
+		sparkCooldownSec_ = s.sparkCooldownSec;
+	}
+
+	void releaseBody()
+	{
+		body_.release();
+		alive_ = false;
+	}
+
+	void hideTrails()
+	{
+		timerHideTrails_.restart(1s);
+	}
+
+	void resetLife()
+	{
+		life_ = 100.0;
+	}
+
+	// 敵の枠を空ける（ホットリロード用。配列の途中の車を取り除くと、タイヤ跡が参照している車が動いてしまうので、剛体だけを捨てて枠は残す）
+	// 空いた枠は respawnAsEnemy() で使い直せる
+	void removeAsEnemy()
+	{
+		releaseBody();
+		life_ = 0;
+	}
+
+	// 敵を別の出現位置と動きで出し直す（ホットリロード用。壊れていなければ剛体はそのまま使う）
+	void respawnAsEnemy(const Vec2& pos, double maxSpeed, Circular enemyVelocity, double delay)
+	{
+		if (not alive_)
+		{
+			createBody(pos);
+		}
+
+		maxSpeed_ = maxSpeed;
+		enemyVelocity_ = enemyVelocity;
+		delay_ = delay;
+		elapsedSteps_ = 0;
+		collidedSec_ = 0;
+		resetLife();
+		reset(pos);
+		hideTrails();
+	}
+
+	double life() const
+	{
+		return life_;
+	}
+
+	bool alive() const
+	{
+		return alive_;
+	}
+
+	void setLod(CarLod lod)
+	{
+		// 詳細表示でない間はタイヤ跡を更新していないので、詳細表示に戻ったら古い跡が消えるまで隠す
+		if (lod == CarLod::Full && lod_ != CarLod::Full)
+		{
+			timerHideTrails_.restart(SecondsF{ TrailLifeTime });
+		}
+
+		lod_ = lod;
+	}
+
+	// エフェクトを一切出さない（描画しないシミュレーション用。エフェクトのプールはメインスレッドでしか使えない）
+	void disableEffects()
+	{
+		effectsEnabled_ = false;
+	}
+
+	// 描画用の乱数の ID（ステージの中で車ごとに決まる番号）
+	void setDrawId(uint64 drawId)
+	{
+		drawId_ = drawId;
+	}
+
+	CarLod lod() const
+	{
+		return lod_;
+	}
+
+	// 煙・火花・タイヤ跡を出すか（見た目だけのものなので、遠くの車では出さない）
+	bool emitsEffects() const
+	{
+		return effectsEnabled_ && (lod_ == CarLod::Full || lod_ == CarLod::Simple);
+	}
+
+private:
+	void createBody(const Vec2& pos)
+	{
+		constexpr P2Material material{ .density = 1.0, .restitution = 0.5, .friction = 0.5, };
+		body_ = world_.createRect(P2Dynamic, pos, BodySize, material, filter_);
+		body_.setDamping(2.0);
+		body_.setAngularDamping(5.0);
+		alive_ = true;
+		updatePose();
+	}
+
+	static CarPose MakePose(const Vec2& pos, double angle, double sinAngle, double cosAngle, double sinSteer, double cosSteer)
+	{
+		CarPose pose{ .pos = pos, .angle = angle, .sinAngle = sinAngle, .cosAngle = cosAngle, .sinSteer = sinSteer, .cosSteer = cosSteer };
+		pose.body = pose.rotatedRect(pos, BodySize);
+
+		for (size_t i = 0; i < pose.tires.size(); ++i)
+		{
+			pose.tires[i] = pos + pose.rotate(TireOffsets[i]);
+		}
+
+		return pose;
+	}
+
+	// この車だけ姿勢を求め直す（剛体を作ったり、位置や向きを直接変えたとき）
+	void updatePose()
+	{
+		const double angle = body_.getAngle();
+		const double sinAngle = std::sin(angle);
+		const double cosAngle = std::cos(angle);
+
+		if (tireAngle_ == 0)
+		{
+			pose_ = MakePose(body_.getPos(), angle, sinAngle, cosAngle, sinAngle, cosAngle);
+		}
+		else
+		{
+			pose_ = MakePose(body_.getPos(), angle, sinAngle, cosAngle, std::sin(angle + tireAngle_), std::cos(angle + tireAngle_));
+		}
+	}
+
+	void moveForward(double stepSec, double force)
+	{
+		const auto forwardVec = steeringVec(force);
+		body_.applyForceAt(forwardVec * stepSec, pos() + pose_.forward(8.0));
+		body_.setAngularVelocity(tireAngle_ * 3.0);
+	}
+
+	void moveBack(double stepSec, double force)
+	{
+		const auto forwardVec = steeringVec(force);
+		body_.applyForceAt(-forwardVec * 0.8 * stepSec, pos() + pose_.forward(8.0));
+		body_.setAngularVelocity(-tireAngle_ * 3.0);
+	}
+
+	// 前輪の向きに force のベクトル（Circular{ force, angle + tireAngle }）
+	// 前のティックの終わりに姿勢と一緒に求めた sin/cos を使う（それ以降、力を加えるまでタイヤの向きは変わらない）
+	Vec2 steeringVec(double force) const
+	{
+		return Vec2{ force * pose_.sinSteer, -force * pose_.cosSteer };
+	}
+
+	void turnLeft(double stepSec)
+	{
+		tireAngle_ = Clamp(tireAngle_ - 150_deg * stepSec, -45_deg, 45_deg);
+	}
+
+	void turnRight(double stepSec)
+	{
+		tireAngle_ = Clamp(tireAngle_ + 150_deg * stepSec, -45_deg, 45_deg);
+	}
+
+	void freeHandle(double stepSec)
+	{
+		tireAngle_ = Math::Lerp(tireAngle_, 0, 10.0 * stepSec);
+	}
+
+	void checkCollision(double stepSec, double damage)
+	{
+		collidedSec_ = Max(collidedSec_ - stepSec, 0.0);
+		sparkCooldownSec_ = Max(sparkCooldownSec_ - stepSec, 0.0);
+
+		for (auto&& [pair, collision] : world_.getCollisions())
+		{
+			for (const auto& contact : collision)
+			{
+				const auto velocity = body_.getVelocity();
+
+				// 乱数は詳細度によらず引く（画面に映る車が変わっても、ほかの車のエフェクトの乱数がずれないように）
+				if (effectsEnabled_ && sparkCooldownSec_ <= 0 && velocity.length() > 4.0)
+				{
+					sparkCooldownSec_ = SparkIntervalSec;
+					const DrawRandom random{ EffectRandom::Next(), 0 };
+
+					if (emitsEffects())
+					{
+						for (int i : step(random.integer(0, 1, 2)))
+						{
+							sparkEffect_.add<SparkEffect>(contact.point, velocity.length(), random.hash(1 + i));
+						}
+					}
+				}
+			}
+
+			if (not collided() && (pair.a == body_.id() || pair.b == body_.id()))
+			{
+				collidedSec_ = 0.3;
+			}
+		}
+
+		// 接触ダメージ
+		if (collided())
+		{
+			if (life_ > 0)
+			{
+				life_ -= damage * stepSec;
+
+				if (life_ <= 0 && effectsEnabled_)
+				{
+					// 爆発エフェクト（敵が壊れたことを知らせるので、画面外でも出す）
+					sparkEffect_.add<ExplodeEffect>(body_.getPos(), EffectRandom::Next());
+				}
+			}
+		}
+	}
+
+	// 出す間隔はシミュレーションのステップで数える（乱数は詳細度によらず、1 回出すごとに 1 つ引く）
+	void generateSmoke(double stepSec, double scale = 1.0)
+	{
+		if (not effectsEnabled_) return;
+
+		smokeCooldownSec_ -= stepSec;
+
+		if (smokeCooldownSec_ > 0) return;
+
+		const DrawRandom random{ EffectRandom::Next(), 0 };
+		smokeCooldownSec_ = random.real(0, 0.001, SmokeIntervalSec);
+
+		if (not emitsEffects()) return;
+
+		for (int i : step(random.integer(1, 1, 3)))
+		{
+			smokeEffect_.add<SmokeEffect>(pos() - pose_.forward(12.0), angle() + tireAngle_, scale, random.hash(2 + i));
+		}
+
+		if (body_.getVelocity().length() > 1.0)
+		{
+			for (int iTire : step(4))
+			{
+				smokeEffect_.add<SmokeEffect>(tirePos_(iTire) + random.vec2(8 + iTire, 2.0), angle() + tireAngle_ * 0.3, 0.3 * scale, random.hash(12 + iTire));
+			}
+		}
+	}
+
+	void updateTireTrail(double stepSec)
+	{
+		// タイヤ跡は詳細表示のときしか描かないので、それ以外では更新もしない
+		if (lod_ != CarLod::Full) return;
+
+		for (auto& t : trails_)
+		{
+			t.update(stepSec);
+		}
+	}
+
+	// タイヤの位置
+	// index: 0-3 (時計回り)
+	Vec2 tirePos_(int index) const
+	{
+		return pose_.tires[index];
+	}
+
+	// タイヤ跡の寿命（前輪より長い後輪のもの）
+	static constexpr double TrailLifeTime = 0.3;
+
+	// 車体の中心から見たタイヤの位置（車体の向きが 0 のとき）
+	static inline const std::array<Vec2, 4> TireOffsets{
+		Circular{ 12, -35_deg }.toVec2(),
+		Circular{ 12, 35_deg }.toVec2(),
+		Circular{ 12, 145_deg }.toVec2(),
+		Circular{ 12, 215_deg }.toVec2(),
+	};
+
+private:
+	P2World& world_;
+	EffectLayer& smokeEffect_;
+	EffectLayer& sparkEffect_;
+	Color color_;
+	uint64 drawId_ = 0;
+	double maxSpeed_;
+	Circular enemyVelocity_;
+	double delay_ = 0;
+	P2Body body_;
+
+	// 作成されてからのシミュレーションのステップ数（決定的に動くよう、実時間ではなくステップ数で数える）
+	int32 elapsedSteps_ = 0;
+
+	// タイヤの向き
+	double tireAngle_ = 0;
+
+	// 次に煙・火花を出せるまでの残り時間（シミュレーション時間）
+	static constexpr double SmokeIntervalSec = 0.1;
+	static constexpr double SparkIntervalSec = 0.01;
+	double smokeCooldownSec_ = SmokeIntervalSec;
+	double sparkCooldownSec_ = 0;
+
+	// 接触後のダメージを受ける残り時間（シミュレーション時間）
+	double collidedSec_ = 0;
+
+	// タイヤの跡（車の中に直接持ち、別に確保しない）
+	std::array<TrailMotion, 4> trails_;
+	Timer timerHideTrails_;
+
+	// 耐久力
+	double life_ = 100;
+	bool alive_ = true;
+
+	// 描画とエフェクトの詳細度
+	CarLod lod_ = CarLod::Full;
+	bool effectsEnabled_ = true;
+
+	// 最後に求めた姿勢
+	CarPose pose_;
+
+	// 当たり判定のフィルタ
+	P2Filter filter_;
+
+public:
+	static inline constexpr SizeF BodySize{ 16, 28 };
+	static inline constexpr SizeF TireSize{ 6, 8 };
+};
+
+struct Wall
+{
+	P2Body body;
+	RectF rect;
+};
+
+struct Goal
+{
+	RectF area;
+	Color color;
+	static inline constexpr SizeF Size{ 48, 64 };
+
+	// highlighted: 枠を緑にする（ゴールに収まっているとき）
+	void draw(bool highlighted) const
+	{
+		area
+			.draw(ColorF{ 1.0, 0.1 + 0.1 * Periodic::Jump1_1(0.1s) })
+			.drawFrame(4, 0, ColorF{ highlighted ? Palette::Lime : Palette::White, 0.75 + 0.25 * Periodic::Jump1_1(0.2s) });
+	}
+};
+
+void RemoveEnemies(Array<Car>& enemies)
+{
+	for (auto& e : enemies)
+	{
+		e.releaseBody();
+	}
+	enemies.clear();
+}
+
+// 敵の配置
+struct EnemySpawn
+{
+	Vec2 pos;
+	double maxSpeed;
+	Circular velocity;
+	double delay = 0;
+};
+
+// 1 つのステージの敵の数の上限
+// 敵の配列はこの分を最初に確保し、タイヤ跡が車自身を参照しているので、これを超えて配列を動かさない
+inline constexpr size_t MaxEnemies = 100;
+
+// ステージの寿命を持つ配列（ステージ用のアリーナなど、指定したメモリから確保する）
+template <class Type>
+using StageArray = Array<Type, std::pmr::polymorphic_allocator<Type>>;
+
+// ステージの定義
+struct StageDefinition
+{
+	Vec2 playerPos;
+	RectF goal;
+	StageArray<RectF> walls;
+	StageArray<EnemySpawn> enemies;
+	CollisionRules collision;
+};
+
+// memory: 壁と敵の配列を確保するメモリ
+StageDefinition MakeStageDefinition(int stage, std::pmr::memory_resource* memory = std::pmr::get_default_resource())
+{
+	StageDefinition def{
+		.walls = StageArray<RectF>(memory),
+		.enemies = StageArray<EnemySpawn>(memory),
+	};
+
+	if (stage == 1)
+	{
+		def.playerPos = Vec2{ 128, 128 };
+
+		def.goal = RectF{ Arg::center = Vec2{ 400, 128 }, Goal::Size };
+
+		def.walls << RectF{ Arg::center = Vec2{ 128, 16 }, 40000, 8 };
+		def.walls << RectF{ Arg::center = Vec2{ 128, 256 - 16 }, 40000, 8 };
+		def.walls << RectF{ Arg::center = Vec2{ -250, 128 }, 8, 256 - 16 };
+
+		def.enemies << EnemySpawn{ Vec2{ -160, 128 }, 900, Circular{ 1500, 90_deg } };
+		def.enemies << EnemySpawn{ Vec2{ -120, 128 }, 900, Circular{ 1500, 90_deg } };
+		def.enemies << EnemySpawn{ Vec2{ -80, 128 }, 900, Circular{ 1500, 90_deg } };
+	}
+	else if (stage == 2)
+	{
+		def.playerPos = Vec2{ 1150, 632 };
+
+		def.goal = RectF{ 999, 601, Goal::Size };
+
+		def.walls << RectF{ 1072, 465, 8, 904 };
+		def.walls << RectF{ 1244, 351, 360, 348 };
+		def.walls << RectF{ 1053, 805, 741, 8 };
+		def.walls << RectF{ 1774, 516, 8, 310 };
+		def.walls << RectF{ 80, 366, 1976, 8 };
+		def.walls << RectF{ 252, 1739, 534, 8 };
+		def.walls << RectF{ 766, 351, 8, 1404 };
+		def.walls << RectF{ 909, 471, 8, 1458 };
+		def.walls << RectF{ 67, 1910, 877, 8 };
+		def.walls << RectF{ 84, 1552, 8, 381 };
+		def.walls << RectF{ 906, 466, 183, 8 };
+		def.walls << RectF{ 67, 1571, 534, 8 };
+		def.walls << RectF{ 1051, 1021, 754, 8 };
+		def.walls << RectF{ 2032, 348, 8, 1211 };
+		def.walls << RectF{ 583, 962, 8, 644 };
+		def.walls << RectF{ 560, 974, 231, 8 };
+		def.walls << RectF{ 890, 1526, 1158, 8 };
+		def.walls << RectF{ 1774, 1002, 8, 393 };
+		def.walls << RectF{ 1244, 1196, 360, 348 };
+	}
+	else if (stage == 3)
+	{
+		def.playerPos = Vec2{ 1100, 616 };
+
+		def.goal = RectF{ 1073, 425, Goal::Size.yx() };
+
+		def.walls << RectF{ 255, 510, 1949, 64 };
+		def.walls << RectF{ 494, 760, 1995, 61 };
+		def.walls << RectF{ -13, 8, 2839, 319 };
+		def.walls << RectF{ 968, 236, 61, 389 };
+		def.walls << RectF{ 2144, 453, 61, 318 };
+		def.walls << RectF{ 243, 1026, 1938, 61 };
+		def.walls << RectF{ 2428, 798, 61, 550 };
+		def.walls << RectF{ 242, 510, 61, 841 };
+		def.walls << RectF{ 678, 942, 137, 136 };
+		def.walls << RectF{ 1281, 938, 137, 136 };
+		def.walls << RectF{ 993, 1041, 137, 136 };
+		def.walls << RectF{ 1721, 1044, 137, 136 };
+		def.walls << RectF{ 541, 1287, 1938, 61 };
+		def.walls << RectF{ -13, 1547, 2839, 270 };
+		def.walls << RectF{ 2765, 22, 61, 1782 };
+		def.walls << RectF{ -12, 22, 61, 1782 };
+		def.walls << RectF{ 1000, 1469, 137, 136 };
+		def.walls << RectF{ 1459, 1302, 137, 136 };
+		def.walls << RectF{ 1941, 1454, 137, 136 };
+		def.walls << RectF{ 2347, 400, 281, 231 };
+		def.walls << RectF{ 2620, 1405, 182, 201 };
+		def.walls << RectF{ 2100, 986, 137, 136 };
+		def.walls << RectF{ 1319, 437, 271, 123 };
+		def.walls << RectF{ 1737, 262, 271, 136 };
+
+		def.enemies << EnemySpawn{ Vec2{ 2060, 660 }, 900, Circular{ 3000, -90_deg } };
+		def.enemies << EnemySpawn{ Vec2{ 1860, 660 }, 900, Circular{ 3000, -90_deg } };
+		def.enemies << EnemySpawn{ Vec2{ 1660, 660 }, 900, Circular{ 3000, -90_deg } };
+
+		def.enemies << EnemySpawn{ Vec2{ 2358, 878 }, 900, Circular{ 3500, -90_deg }, 5.0 };
+		def.enemies << EnemySpawn{ Vec2{ 2158, 888 }, 900, Circular{ 3500, -90_deg }, 5.0 };
+		def.enemies << EnemySpawn{ Vec2{ 1958, 848 }, 900, Circular{ 3500, -90_deg }, 5.0 };
+		def.enemies << EnemySpawn{ Vec2{ 1758, 878 }, 900, Circular{ 3500, -90_deg }, 5.0 };
+		def.enemies << EnemySpawn{ Vec2{ 1558, 858 }, 900, Circular{ 3500, -90_deg }, 5.0 };
+
+		def.enemies << EnemySpawn{ Vec2{ 364, 1238 }, 900, Circular{ 4000, 90_deg }, 14.0 };
+		def.enemies << EnemySpawn{ Vec2{ 564, 1228 }, 900, Circular{ 4000, 90_deg }, 13.0 };
+		def.enemies << EnemySpawn{ Vec2{ 764, 1248 }, 900, Circular{ 4000, 90_deg }, 12.0 };
+		def.enemies << EnemySpawn{ Vec2{ 964, 1238 }, 900, Circular{ 4000, 90_deg }, 11.0 };
+		def.enemies << EnemySpawn{ Vec2{ 1164, 1228 }, 900, Circular{ 4000, 90_deg }, 10.0 };
+
+		def.enemies << EnemySpawn{ Vec2{ 130, 417 }, 900, Circular{ 5000, 180_deg }, 25.0 };
+		def.enemies << EnemySpawn{ Vec2{ 95, 407 }, 900, Circular{ 5000, 180_deg }, 25.0 };
+		def.enemies << EnemySpawn{ Vec2{ 155, 407 }, 900, Circular{ 5000, 180_deg }, 25.0 };
+		def.enemies << EnemySpawn{ Vec2{ 120, 617 }, 900, Circular{ 5100, 180_deg }, 22.0 };
+		def.enemies << EnemySpawn{ Vec2{ 95, 607 }, 900, Circular{ 5100, 180_deg }, 22.0 };
+		def.enemies << EnemySpawn{ Vec2{ 165, 607 }, 900, Circular{ 5100, 180_deg }, 22.0 };
+		def.enemies << EnemySpawn{ Vec2{ 130, 817 }, 900, Circular{ 5200, 180_deg }, 20.0 };
+		def.enemies << EnemySpawn{ Vec2{ 95, 807 }, 900, Circular{ 5200, 180_deg }, 20.0 };
+		def.enemies << EnemySpawn{ Vec2{ 155, 807 }, 900, Circular{ 5200, 180_deg }, 20.0 };
+
+		def.enemies << EnemySpawn{ Vec2{ 2619, 729 }, 900, Circular{ 6400, 180_deg }, 33.5 - 2.0 };
+		def.enemies << EnemySpawn{ Vec2{ 2649, 729 }, 900, Circular{ 6400, 180_deg }, 34.0 - 2.0 };
+		def.enemies << EnemySpawn{ Vec2{ 2589, 729 }, 900, Circular{ 6400, 180_deg }, 34.5 - 2.0 };
+		def.enemies << EnemySpawn{ Vec2{ 2619, 829 }, 900, Circular{ 6400, 180_deg }, 29.5 - 2.0 };
+		def.enemies << EnemySpawn{ Vec2{ 2649, 829 }, 900, Circular{ 6400, 180_deg }, 30.0 - 2.0 };
+		def.enemies << EnemySpawn{ Vec2{ 2589, 829 }, 900, Circular{ 6400, 180_deg }, 30.5 - 2.0 };
+	}
+	else if (stage == 0)
+	{
+		def.playerPos = Vec2{ 128, 128 };
+
+		def.goal = RectF{};
+	}
+
+	return def;
+}
+
+// 壁の剛体を定義の順に作る
+// ゲームと StageSimulation で同じ順に作り、同じ入力から同じ結果になるようにする
+void CreateWalls(P2World& world, std::span<const RectF> rects, const P2Filter& filter, StageArray<Wall>& walls)
+{
+	for (const auto& rect : rects)
+	{
+		walls << Wall{ world.createRect(P2Static, rect.center(), rect.size, {}, filter), rect };
+	}
+}
+
+// ステージの壁を空間的なチャンクに分け、画面の周囲のチャンクにある壁だけを描画する
+// 壁の剛体は、敵の動きがプレイヤーの位置に左右されないよう、ステージの読み込み時に全て作成する（StageSimulation と同じ）
+// そのため壁のデータは全てメモリに置いたままで、チャンクは描画する壁を絞り込むためだけに使う
+class StageStreamer
+{
+public:
+	// チャンクの一辺の長さ
+	static constexpr double ChunkSize = 256.0;
+
+	// stageMemory: 壁の剛体の配列を確保するメモリ（ゲームではステージ用のアリーナ。アリーナを捨てる前に clear() を呼ぶこと）
+	explicit StageStreamer(P2World& world, std::pmr::memory_resource* stageMemory = std::pmr::get_default_resource())
+		: world_{ world }
+		, walls_(stageMemory)
+		, wallIds_(stageMemory)
+	{
+	}
+
+	~StageStreamer()
+	{
+		clear();
+	}
+
+	// 画面に映る範囲（ズームアウトを考慮）に 1 チャンク分のマージンを加えた読み込み半径
+	static double LoadRadius(double zoom)
+	{
+		return (SceneWidth * Math::Sqrt2 / 2) / zoom + ChunkSize;
+	}
+
+	// 全ての壁の剛体を filter の当たり判定で作成し、壁をチャンクに分ける
+	void load(std::span<const RectF> walls, const P2Filter& filter)
+	{
+		clear();
+
+		filter_ = filter;
+		walls_.reserve(walls.size());
+		wallIds_.reserve(walls.size());
+		CreateWalls(world_, walls, filter_, walls_);
+
+		for (const auto& [i, rect] : Indexed(walls))
+		{
+			wallIds_ << static_cast<uint32>(i);
+			addToBuckets(ChunkWall{ static_cast<uint32>(i), rect });
+		}
+	}
+
+	// 指定位置の周囲のチャンクを、その場で描画する壁に加える（ステージ開始時や、巻き戻しなどでプレイヤーが跳んだとき用）
+	void prime(const Vec2& center, double radius)
+	{
+		request(center, radius);
+	}
+
+	// 毎フレーム呼ぶ
+	// 近くのチャンクの壁を描画する壁に加え、遠くのチャンクの壁を外す
+	void update(const Vec2& center, double radius)
+	{
+		update(std::span{ &center, 1 }, radius);
+	}
+
+	// 複数の位置（分割画面のプレイヤーごとなど）のどれかに近いチャンクを描画する
+	void update(std::span<const Vec2> centers, double radius)
+	{
+		for (const auto& center : centers)
+		{
+			request(center, radius);
+		}
+
+		// どの読み込み範囲からも 1 チャンク分以上離れたチャンクを外す
+		evicting_.clear();
+
+		for (const auto& coord : loaded_)
+		{
+			const RectF rect = ChunkRect(coord);
+			bool keep = false;
+
+			for (const auto& center : centers)
+			{
+				keep = keep || rect.intersects(Circle{ center, radius + ChunkSize });
+			}
+
+			if (not keep)
+			{
+				evicting_ << coord;
+			}
+		}
+
+		for (const auto& coord : evicting_)
+		{
+			hide(coord);
+			loaded_.erase(coord);
+		}
+	}
+
+	// 壁の変更（ホットリロード用）
+	// before だけなら削除、after だけなら追加、両方なら移動・大きさの変更。id はステージ内で一意
+	struct WallChange
+	{
+		uint32 id;
+		Optional<RectF> before;
+		Optional<RectF> after;
+	};
+
+	// 変更のあった壁の剛体と、関係するチャンクだけを作り直す
+	// ほかの壁の剛体と、描画中のチャンクはそのまま使う
+	void patch(std::span<const WallChange> changes)
+	{
+		if (changes.empty()) return;
+
+		HashSet<uint32> changedIds;
+		HashSet<Point> touched;
+
+		for (const auto& change : changes)
+		{
+			changedIds.insert(change.id);
+
+			if (change.before)
+			{
+				AddChunkCoords(*change.before, touched);
+				releaseBody(change.id);
+			}
+
+			if (change.after)
+			{
+				AddChunkCoords(*change.after, touched);
+				walls_ << Wall{ world_.createRect(P2Static, change.after->center(), change.after->size, {}, filter_), *change.after };
+				wallIds_ << change.id;
+			}
+		}
+
+		// 先に描画中のチャンクの壁を全て外す（移動した壁が別のチャンクに参照されたまま残らないように）
+		for (const auto& coord : touched)
+		{
+			if (loaded_.contains(coord))
+			{
+				hide(coord);
+			}
+		}
+
+		for (const auto& coord : touched)
+		{
+			if (auto it = buckets_.find(coord); it != buckets_.end())
+			{
+				it->second.remove_if([&](const ChunkWall& wall) { return changedIds.contains(wall.id); });
+			}
+		}
+
+		for (const auto& change : changes)
+		{
+			if (change.after)
+			{
+				addToBuckets(ChunkWall{ change.id, *change.after });
+			}
+		}
+
+		for (const auto& coord : touched)
+		{
+			if (loaded_.contains(coord))
+			{
+				show(coord);
+			}
+		}
+	}
+
+	// 壁の当たり判定を変える（作成済みの剛体にも反映する）
+	void setFilter(const P2Filter& filter)
+	{
+		filter_ = filter;
+
+		for (auto& wall : walls_)
+		{
+			wall.body.shape(0).setFilter(filter_);
+		}
+	}
+
+	// 全ての壁の剛体と、チャンクを破棄する
+	void clear()
+	{
+		buckets_.clear();
+		loaded_.clear();
+		visible_.clear();
+		visibleIds_.clear();
+		slots_.clear();
+
+		for (auto& wall : walls_)
+		{
+			wall.body.release();
+		}
+
+		// 配列のメモリもここで手放し、次のステージの確保がアリーナの先頭からになるようにする
+		walls_ = StageArray<Wall>(walls_.get_allocator());
+		wallIds_ = StageArray<uint32>(wallIds_.get_allocator());
+	}
+
+	// ステージの全ての壁（剛体つき）
+	const StageArray<Wall>& walls() const
+	{
+		return walls_;
+	}
+
+	// 描画中のチャンクにある、描画する壁
+	const Array<RectF>& visibleWalls() const
+	{
+		return visible_;
+	}
+
+	size_t loadedChunkCount() const
+	{
+		return loaded_.size();
+	}
+
+	size_t chunkCount() const
+	{
+		return buckets_.size();
+	}
+
+private:
+	// チャンク内の壁（id はステージ内で一意）
+	struct ChunkWall
+	{
+		uint32 id;
+		RectF rect;
+	};
+
+	struct VisibleSlot
+	{
+		size_t index;
+		int32 refs;
+	};
+
+	static Point ToChunkCoord(const Vec2& pos)
+	{
+		return Point{ static_cast<int32>(Math::Floor(pos.x / ChunkSize)), static_cast<int32>(Math::Floor(pos.y / ChunkSize)) };
+	}
+
+	static RectF ChunkRect(const Point& coord)
+	{
+		return RectF{ coord.x * ChunkSize, coord.y * ChunkSize, ChunkSize, ChunkSize };
+	}
+
+	// 壁が重なる全てのチャンク（四隅のチャンク座標の範囲）
+	static void AddChunkCoords(const RectF& rect, HashSet<Point>& coords)
+	{
+		const Point minCoord = ToChunkCoord(rect.tl());
+		const Point maxCoord = ToChunkCoord(rect.br());
+
+		for (int32 y = minCoord.y; y <= maxCoord.y; ++y)
+		{
+			for (int32 x = minCoord.x; x <= maxCoord.x; ++x)
+			{
+				coords.insert(Point{ x, y });
+			}
+		}
+	}
+
+	// 壁を、重なっている全てのチャンクに登録する
+	void addToBuckets(const ChunkWall& wall)
+	{
+		const Point minCoord = ToChunkCoord(wall.rect.tl());
+		const Point maxCoord = ToChunkCoord(wall.rect.br());
+
+		for (int32 y = minCoord.y; y <= maxCoord.y; ++y)
+		{
+			for (int32 x = minCoord.x; x <= maxCoord.x; ++x)
+			{
+				buckets_[Point{ x, y }] << wall;
+			}
+		}
+	}
+
+	void request(const Vec2& center, double radius)
+	{
+		const Circle area{ center, radius };
+		const Point minCoord = ToChunkCoord(center - Vec2::All(radius));
+		const Point maxCoord = ToChunkCoord(center + Vec2::All(radius));
+
+		for (int32 y = minCoord.y; y <= maxCoord.y; ++y)
+		{
+			for (int32 x = minCoord.x; x <= maxCoord.x; ++x)
+			{
+				const Point coord{ x, y };
+
+				if (not buckets_.contains(coord) || loaded_.contains(coord)) continue;
+
+				if (not ChunkRect(coord).intersects(area)) continue;
+
+				loaded_.insert(coord);
+				show(coord);
+			}
+		}
+	}
+
+	// チャンクの壁を、描画する壁に加える
+	void show(const Point& coord)
+	{
+		if (auto it = buckets_.find(coord); it != buckets_.end())
+		{
+			for (const auto& wall : it->second)
+			{
+				acquireVisible(wall);
+			}
+		}
+	}
+
+	void hide(const Point& coord)
+	{
+		if (auto it = buckets_.find(coord); it != buckets_.end())
+		{
+			for (const auto& wall : it->second)
+			{
+				releaseVisible(wall.id);
+			}
+		}
+	}
+
+	// 描画する壁の参照を増やす（複数のチャンクにまたがる壁は 1 つだけ描く）
+	void acquireVisible(const ChunkWall& wall)
+	{
+		if (auto it = slots_.find(wall.id); it != slots_.end())
+		{
+			++it->second.refs;
+			return;
+		}
+
+		slots_.emplace(wall.id, VisibleSlot{ visible_.size(), 1 });
+		visible_ << wall.rect;
+		visibleIds_ << wall.id;
+	}
+
+	// 描画する壁の参照を減らし、どのチャンクからも参照されなくなったら外す
+	void releaseVisible(uint32 id)
+	{
+		auto& slot = slots_[id];
+
+		if (--slot.refs > 0) return;
+
+		const size_t index = slot.index;
+
+		if (index != visible_.size() - 1)
+		{
+			visible_[index] = visible_.back();
+			visibleIds_[index] = visibleIds_.back();
+			slots_[visibleIds_[index]].index = index;
+		}
+
+		visible_.pop_back();
+		visibleIds_.pop_back();
+		slots_.erase(id);
+	}
+
+	// 壁の剛体を解放する（ホットリロードで削除・移動した壁）
+	void releaseBody(uint32 id)
+	{
+		const auto it = std::find(wallIds_.begin(), wallIds_.end(), id);
+
+		if (it == wallIds_.end()) return;
+
+		const size_t index = std::distance(wallIds_.begin(), it);
+		walls_[index].body.release();
+
+		if (index != walls_.size() - 1)
+		{
+			walls_[index] = walls_.back();
+			wallIds_[index] = wallIds_.back();
+		}
+
+		walls_.pop_back();
+		wallIds_.pop_back();
+	}
+
+	P2World& world_;
+
+	// 壁の当たり判定
+	P2Filter filter_;
+
+	// ステージの全ての壁の剛体と、その id（ステージの間だけ使うので、ステージ用のメモリから確保する）
+	StageArray<Wall> walls_;
+	StageArray<uint32> wallIds_;
+
+	// チャンクごとの壁（壁を含むチャンクだけ）
+	HashTable<Point, Array<ChunkWall>> buckets_;
+
+	// 描画中のチャンク
+	HashSet<Point> loaded_;
+	Array<Point> evicting_;
+
+	// 描画する壁と、その id
+	Array<RectF> visible_;
+	Array<uint32> visibleIds_;
+	HashTable<uint32, VisibleSlot> slots_;
+};
+
+// ステージ全体を縮小したミニマップ
+// 壁とゴールは LoadStage のときに一度だけテクスチャへ描き込み、毎フレームは印だけを上に描く
+class Minimap
+{
+public:
+	// ミニマップの一辺（シーン上のピクセル数）
+	static constexpr int32 Size = 56;
+
+	// 縮小する範囲の一辺の上限（ステージ 1 のような極端に長い壁を切り詰める）
+	static constexpr double MaxExtent = 4096;
+
+	void build(const StageDefinition& def)
+	{
+		if (def.walls.isEmpty())
+		{
+			texture_.release();
+			return;
+		}
+
+		// スタート地点とゴールを中心に、壁が収まる正方形の範囲を求める
+		const Vec2 center = (def.playerPos + def.goal.center()) / 2;
+		const RectF limit{ Arg::center = center, MaxExtent };
+
+		Vec2 tl = def.goal.tl();
+		Vec2 br = def.goal.br();
+
+		for (const auto& wall : def.walls)
+		{
+			const RectF clipped = wall.getOverlap(limit);
+
+			if (clipped.isEmpty()) continue;
+
+			tl = Vec2{ Min(tl.x, clipped.x), Min(tl.y, clipped.y) };
+			br = Vec2{ Max(br.x, clipped.br().x), Max(br.y, clipped.br().y) };
+		}
+
+		const double extent = Max(br.x - tl.x, br.y - tl.y);
+		area_ = RectF{ Arg::center = (tl + br) / 2, extent };
+		scale_ = Size / extent;
+
+		Image image{ Size, Size, Color{ 0, 0 } };
+
+		for (const auto& wall : def.walls)
+		{
+			if (const RectF clipped = wall.getOverlap(limit); not clipped.isEmpty())
+			{
+				toImageRect(clipped).overwrite(image, Palette::Whitesmoke);
+			}
+		}
+
+		toImageRect(def.goal).overwrite(image, Color{ Palette::Lime, 160 });
+
+		texture_ = Texture{ image };
+	}
+
+	void draw(const Vec2& pos, const Car& player, const Array<Car>& enemies, const Goal& goal) const
+	{
+		if (not texture_) return;
+
+		const RectF frame{ pos, Size };
+		frame.stretched(1).draw(ColorF{ 0, 0.6 }).drawFrame(1, 0, ColorF{ 1.0, 0.5 });
+		texture_.draw(pos, ColorF{ 1.0, 0.7 });
+
+		// ゴール
+		RectF{ toMap(pos, goal.area.tl()), goal.area.size * scale_ }
+			.stretched(1)
+			.drawFrame(1, 0, ColorF{ Palette::Lime, Periodic::Square0_1(0.4s) });
+
+		// 敵
+		for (const auto& e : enemies)
+		{
+			if (e.alive() && e.life() > 0)
+			{
+				const Vec2 p = toMap(pos, e.pos());
+
+				if (frame.contains(p))
+				{
+					RectF{ Arg::center = p, 2 }.draw(Palette::Tomato);
+				}
+			}
+		}
+
+		// プレイヤー（向きのわかる三角形）
+		const Vec2 p = toMap(pos, player.pos());
+
+		if (frame.contains(p))
+		{
+			Triangle{ p, 5, player.angle() }.draw(Palette::White);
+		}
+	}
+
+private:
+	Rect toImageRect(const RectF& rect) const
+	{
+		const Vec2 tl = (rect.tl() - area_.tl()) * scale_;
+		const Vec2 br = (rect.br() - area_.tl()) * scale_;
+		return Rect{ static_cast<int32>(Math::Floor(tl.x)), static_cast<int32>(Math::Floor(tl.y)),
+			Max(1, static_cast<int32>(Math::Ceil(br.x - tl.x))), Max(1, static_cast<int32>(Math::Ceil(br.y - tl.y))) };
+	}
+
+	Vec2 toMap(const Vec2& origin, const Vec2& worldPos) const
+	{
+		return origin + (worldPos - area_.tl()) * scale_;
+	}
+
+	Texture texture_;
+	RectF area_{ 0, 0, 1, 1 };
+	double scale_ = 1.0;
+};
+
+// 敵を定義の順に作る（描画用の乱数の ID は、プレイヤーが 0、敵が 1 から）
+// ゲームと StageSimulation で同じ順に作り、同じ入力から同じ結果になるようにする
+void SpawnEnemies(P2World& world, EffectLayer& smokeEffect, EffectLayer& sparkEffect, std::span<const EnemySpawn> spawns, const P2Filter& filter, Array<Car>& enemies)
+{
+	// 上限を超える分は作らない（定義ファイルから読むときは、StageHotReloader::load() で切り詰めて数を報告する）
+	const std::span<const EnemySpawn> created = spawns.first(Min(spawns.size(), MaxEnemies));
+
+	for (const auto& [i, spawn] : Indexed(created))
+	{
+		enemies.emplace_back(world, smokeEffect, sparkEffect, spawn.pos, Palette::Tomato, spawn.maxSpeed, spawn.velocity, spawn.delay);
+		enemies.back().setCollisionFilter(filter);
+		enemies.back().setDrawId(i + 1);
+	}
+}
+
+// def: ステージの定義（組み込みの MakeStageDefinition() か、ホットリロード用の定義ファイルから作る）
+void LoadStage(int stage, const StageDefinition& def, P2World& world, StageStreamer& streamer, Array<Car>& enemies, Car& player, Goal& goal, CollisionRules& collision, Minimap& minimap, EffectLayer& smokeEffect, EffectLayer& sparkEffect)
+{
+	RemoveEnemies(enemies);
+
+	player.hideTrails();
+	player.resetLife();
+
+	player.reset(def.playerPos);
+
+	goal.area = def.goal;
+
+	// 当たり判定のフィルタはステージごと
+	collision = def.collision;
+	player.setCollisionFilter(collision.playerFilter());
+
+	// 壁の剛体は全て作り、描画用にはチャンクに分けて、スタート地点の周囲だけをここで描画する壁に加える
+	streamer.load(def.walls, collision.wallFilter());
+	streamer.prime(def.playerPos, StageStreamer::LoadRadius(1.0));
+
+	// ミニマップはステージ全体の定義から一度だけ作る
+	minimap.build(def);
+
+	// 敵は動き回るので、最初に全て作成する
+	SpawnEnemies(world, smokeEffect, sparkEffect, def.enemies, collision.enemyFilter(), enemies);
+
+	// エフェクトの乱数はステージごとに同じ列から始める
+	EffectRandom::Reseed(EffectRandom::DefaultSeed + stage);
+}
+
+// ステージの定義ファイル（--hot-reload で使う）
+// 1 行に 1 つ、「種類 値…」を空白で区切って書く。# から行末まではコメント
+//   player x y / goal x y w h / collision playerMask enemyMask wallMask
+//   wall x y w h / enemy x y maxSpeed speed angle(度) delay
+namespace StageFile
+{
+	inline FilePath Path(int stage)
+	{
+		return U"stages/stage{}.txt"_fmt(stage);
+	}
+
+	bool Save(const FilePath& path, const StageDefinition& def)
+	{
+		TextWriter writer{ path };
+
+		if (not writer)
+		{
+			return false;
+		}
+
+		writer.writeln(U"# player x y / goal x y w h / collision playerMask enemyMask wallMask / wall x y w h / enemy x y maxSpeed speed angle delay");
+		writer.writeln(U"player {} {}"_fmt(def.playerPos.x, def.playerPos.y));
+		writer.writeln(U"goal {} {} {} {}"_fmt(def.goal.x, def.goal.y, def.goal.w, def.goal.h));
+		writer.writeln(U"collision {} {} {}"_fmt(def.collision.playerMask, def.collision.enemyMask, def.collision.wallMask));
+
+		for (const auto& wall : def.walls)
+		{
+			writer.writeln(U"wall {} {} {} {}"_fmt(wall.x, wall.y, wall.w, wall.h));
+		}
+
+		for (const auto& spawn : def.enemies)
+		{
+			writer.writeln(U"enemy {} {} {} {} {} {}"_fmt(spawn.pos.x, spawn.pos.y, spawn.maxSpeed, spawn.velocity.r, Math::ToDegrees(spawn.velocity.theta), spawn.delay));
+		}
+
+		return true;
+	}
+
+	// 書きかけのファイルなど、読めない行が 1 つでもあれば none を返す
+	Optional<StageDefinition> Load(const FilePath& path, std::pmr::memory_resource* memory)
+	{
+		TextReader reader{ path };
+
+		if (not reader)
+		{
+			return none;
+		}
+
+		StageDefinition def{
+			.walls = StageArray<RectF>(memory),
+			.enemies = StageArray<EnemySpawn>(memory),
+		};
+
+		String line;
+		std::array<double, 6> values{};
+
+		while (reader.readLine(line))
+		{
+			std::u32string_view rest{ line.data(), line.size() };
+			rest = rest.substr(0, rest.find(U'#'));
+
+			const auto nextToken = [&]() -> std::u32string_view
+				{
+					const size_t begin = rest.find_first_not_of(U" \t\r");
+
+					if (begin == std::u32string_view::npos)
+					{
+						rest = {};
+						return {};
+					}
+
+					const size_t end = Min(rest.find_first_of(U" \t\r", begin), rest.size());
+					const std::u32string_view token = rest.substr(begin, end - begin);
+					rest = rest.substr(end);
+					return token;
+				};
+
+			const std::u32string_view kind = nextToken();
+
+			if (kind.empty()) continue;
+
+			size_t count = 0;
+
+			for (std::u32string_view token = nextToken(); not token.empty(); token = nextToken())
+			{
+				const Optional<double> value = ParseOpt<double>(StringView{ token.data(), token.size() });
+
+				if (not value || count == values.size())
+				{
+					return none;
+				}
+
+				values[count++] = *value;
+			}
+
+			if (kind == U"wall" && count == 4)
+			{
+				def.walls << RectF{ values[0], values[1], values[2], values[3] };
+			}
+			else if (kind == U"enemy" && count == 6)
+			{
+				def.enemies << EnemySpawn{ Vec2{ values[0], values[1] }, values[2], Circular{ values[3], Math::ToRadians(values[4]) }, values[5] };
+			}
+			else if (kind == U"player" && count == 2)
+			{
+				def.playerPos = Vec2{ values[0], values[1] };
+			}
+			else if (kind == U"goal" && count == 4)
+			{
+				def.goal = RectF{ values[0], values[1], values[2], values[3] };
+			}
+			else if (kind == U"collision" && count == 3)
+			{
+				def.collision = CollisionRules{ static_cast<uint16>(values[0]), static_cast<uint16>(values[1]), static_cast<uint16>(values[2]) };
+			}
+			else
+			{
+				return none;
+			}
+		}
+
+		return def;
+	}
+}
+
+// ステージの定義ファイルを監視し、書き換わったら前の定義との差分だけをステージに反映する（--hot-reload）
+// プレイヤーとタイマーはそのままで、変わった壁の剛体と敵だけを作り直す
+class StageHotReloader
+{
+public:
+	StageHotReloader()
+		: watcher_{ PrepareDirectory() }
+	{
+	}
+
+	// ステージを読み込むときに、組み込みの定義の代わりに使う定義を返す
+	// 定義ファイルがなければ組み込みの定義を書き出し、読めなければ組み込みの定義を使う
+	StageDefinition load(int stage, std::pmr::memory_resource* memory)
+	{
+		const FilePath path = StageFile::Path(stage);
+
+		if (not FileSystem::Exists(path))
+		{
+			StageFile::Save(path, MakeStageDefinition(stage));
+		}
+
+		path_ = FileSystem::FullPath(path);
+
+		Optional<StageDefinition> def = StageFile::Load(path_, memory);
+
+		if (not def)
+		{
+			def = MakeStageDefinition(stage, memory);
+		}
+
+		// ステージの読み込み直後の壁の id は、定義の中の順番
+		ids_.resize(def->walls.size());
+
+		for (size_t i = 0; i < ids_.size(); ++i)
+		{
+			ids_[i] = static_cast<uint32>(i);
+		}
+
+		nextId_ = static_cast<uint32>(ids_.size());
+
+		// 敵は上限まで（作れない敵は定義から外し、数を報告する）
+		enemiesDroppedOnLoad_ = def->enemies.size() - Min(def->enemies.size(), MaxEnemies);
+		def->enemies.resize(def->enemies.size() - enemiesDroppedOnLoad_);
+		spawns_.assign(def->enemies.begin(), def->enemies.end());
+
+		remember(*def);
+		return std::move(*def);
+	}
+
+	// 直前の load() で、上限を超えて作らなかった敵の数
+	size_t enemiesDroppedOnLoad() const
+	{
+		return enemiesDroppedOnLoad_;
+	}
+
+	// 毎フレーム呼ぶ。今のステージの定義ファイルが書き換わっていたら差分を反映し、その結果を返す
+	Optional<StageReloadResult> update(P2World& world, StageStreamer& streamer, Array<Car>& enemies, Car& player, Goal& goal, CollisionRules& collision, Minimap& minimap, EffectLayer& smokeEffect, EffectLayer& sparkEffect)
+	{
+		bool modified = false;
+
+		for (const auto& change : watcher_.retrieveChanges())
+		{
+			modified = modified || ((change.action != FileAction::Removed) && (FileSystem::FullPath(change.path) == path_));
+		}
+
+		if (not modified) return none;
+
+		const uint64 startUs = Time::GetMicrosec();
+		const Optional<StageDefinition> def = StageFile::Load(path_, std::pmr::get_default_resource());
+
+		if (not def) return none;
+
+		StageReloadResult result;
+
+		// 壁
+		diffWalls(def->walls, result);
+		streamer.patch(changes_);
+
+		// 当たり判定のフィルタ
+		if (def->collision != collision)
+		{
+			collision = def->collision;
+			player.setCollisionFilter(collision.playerFilter());
+			streamer.setFilter(collision.wallFilter());
+
+			for (auto& e : enemies)
+			{
+				e.setCollisionFilter(collision.enemyFilter());
+			}
+		}
+
+		// 敵
+		diffEnemies(def->enemies, world, enemies, collision, smokeEffect, sparkEffect, result);
+
+		// ゴールとミニマップ（プレイヤーのスタート地点は、今のプレイヤーを動かさないので使わない）
+		if (def->goal != goal_ || not changes_.isEmpty())
+		{
+			goal.area = def->goal;
+			minimap.build(*def);
+		}
+
+		remember(*def);
+		result.ms = (Time::GetMicrosec() - startUs) / 1000.0;
+		return result;
+	}
+
+private:
+	static FilePath PrepareDirectory()
+	{
+		FileSystem::CreateDirectories(U"stages/");
+		return U"stages/";
+	}
+
+	// 同じ長方形の壁は id をそのまま引き継ぎ、残りは元の順に組にして移動とし、余りを追加・削除とする
+	void diffWalls(std::span<const RectF> walls, StageReloadResult& result)
+	{
+		constexpr uint32 Unmatched = Largest<uint32>;
+
+		const auto less = [](const RectF& a, const RectF& b)
+			{
+				return std::tie(a.x, a.y, a.w, a.h) < std::tie(b.x, b.y, b.w, b.h);
+			};
+
+		changes_.clear();
+		newIds_.assign(walls.size(), Unmatched);
+		matched_.assign(walls_.size(), false);
+
+		// 長方形の値で並べ、同じものを突き合わせる
+		oldOrder_.resize(walls_.size());
+		newOrder_.resize(walls.size());
+
+		for (size_t i = 0; i < oldOrder_.size(); ++i)
+		{
+			oldOrder_[i] = i;
+		}
+
+		for (size_t i = 0; i < newOrder_.size(); ++i)
+		{
+			newOrder_[i] = i;
+		}
+
+		oldOrder_.sort_by([&](size_t a, size_t b) { return less(walls_[a], walls_[b]); });
+		newOrder_.sort_by([&](size_t a, size_t b) { return less(walls[a], walls[b]); });
+
+		for (size_t a = 0, b = 0; (a < oldOrder_.size()) && (b < newOrder_.size());)
+		{
+			const RectF& before = walls_[oldOrder_[a]];
+			const RectF& after = walls[newOrder_[b]];
+
+			if (less(before, after))
+			{
+				++a;
+			}
+			else if (less(after, before))
+			{
+				++b;
+			}
+			else
+			{
+				newIds_[newOrder_[b]] = ids_[oldOrder_[a]];
+				matched_[oldOrder_[a]] = true;
+				++a;
+				++b;
+			}
+		}
+
+		// 突き合わなかったもの
+		size_t oldIndex = 0;
+
+		for (size_t i = 0; i < walls.size(); ++i)
+		{
+			if (newIds_[i] != Unmatched) continue;
+
+			while (oldIndex < walls_.size() && matched_[oldIndex])
+			{
+				++oldIndex;
+			}
+
+			if (oldIndex < walls_.size())
+			{
+				newIds_[i] = ids_[oldIndex];
+				changes_ << StageStreamer::WallChange{ ids_[oldIndex], walls_[oldIndex], walls[i] };
+				++result.wallsMoved;
+				++oldIndex;
+			}
+			else
+			{
+				newIds_[i] = nextId_++;
+				changes_ << StageStreamer::WallChange{ newIds_[i], none, walls[i] };
+				++result.wallsAdded;
+			}
+		}
+
+		for (; oldIndex < walls_.size(); ++oldIndex)
+		{
+			if (not matched_[oldIndex])
+			{
+				changes_ << StageStreamer::WallChange{ ids_[oldIndex], walls_[oldIndex], none };
+				++result.wallsRemoved;
+			}
+		}
+
+		ids_.swap(newIds_);
+	}
+
+	// 敵も壁と同じく値の同じものを突き合わせてそのまま残し、残りは元の順に組にしてその場で出し直す
+	// 余った古い敵は枠を空け、余った新しい敵は空いた枠か配列の末尾に出す（上限を超える分は作らずに数える）
+	void diffEnemies(std::span<const EnemySpawn> spawns, P2World& world, Array<Car>& enemies, const CollisionRules& collision, EffectLayer& smokeEffect, EffectLayer& sparkEffect, StageReloadResult& result)
+	{
+		const auto less = [](const EnemySpawn& a, const EnemySpawn& b)
+			{
+				return std::tie(a.pos.x, a.pos.y, a.maxSpeed, a.velocity.r, a.velocity.theta, a.delay) < std::tie(b.pos.x, b.pos.y, b.maxSpeed, b.velocity.r, b.velocity.theta, b.delay);
+			};
+
+		// 値で並べ、同じものを突き合わせる（空いた枠は並べない）
+		oldOrder_.clear();
+		newOrder_.resize(spawns.size());
+
+		for (size_t i = 0; i < spawns_.size(); ++i)
+		{
+			if (spawns_[i])
+			{
+				oldOrder_ << i;
+			}
+		}
+
+		for (size_t i = 0; i < newOrder_.size(); ++i)
+		{
+			newOrder_[i] = i;
+		}
+
+		oldOrder_.sort_by([&](size_t a, size_t b) { return less(*spawns_[a], *spawns_[b]); });
+		newOrder_.sort_by([&](size_t a, size_t b) { return less(spawns[a], spawns[b]); });
+
+		matched_.assign(spawns_.size(), false);
+		newMatched_.assign(spawns.size(), false);
+
+		for (size_t a = 0, b = 0; (a < oldOrder_.size()) && (b < newOrder_.size());)
+		{
+			const EnemySpawn& before = *spawns_[oldOrder_[a]];
+			const EnemySpawn& after = spawns[newOrder_[b]];
+
+			if (less(before, after))
+			{
+				++a;
+			}
+			else if (less(after, before))
+			{
+				++b;
+			}
+			else
+			{
+				matched_[oldOrder_[a]] = true;
+				newMatched_[newOrder_[b]] = true;
+				++a;
+				++b;
+			}
+		}
+
+		// 突き合わなかったもの（古い敵の枠をその場で使い直し、足りなければ空いた枠か末尾に出す）
+		size_t oldIndex = 0;
+		size_t vacantIndex = 0;
+
+		for (size_t i = 0; i < spawns.size(); ++i)
+		{
+			if (newMatched_[i]) continue;
+
+			const EnemySpawn& spawn = spawns[i];
+
+			while (oldIndex < spawns_.size() && (matched_[oldIndex] || not spawns_[oldIndex]))
+			{
+				++oldIndex;
+			}
+
+			size_t slot = oldIndex;
+
+			if (oldIndex < spawns_.size())
+			{
+				++oldIndex;
+			}
+			else
+			{
+				while (vacantIndex < spawns_.size() && spawns_[vacantIndex])
+				{
+					++vacantIndex;
+				}
+
+				slot = vacantIndex;
+			}
+
+			if (slot < spawns_.size())
+			{
+				enemies[slot].respawnAsEnemy(spawn.pos, spawn.maxSpeed, spawn.velocity, spawn.delay);
+				enemies[slot].setCollisionFilter(collision.enemyFilter());
+				spawns_[slot] = spawn;
+				matched_[slot] = true;
+			}
+			else if (enemies.size() < MaxEnemies)
+			{
+				// タイヤ跡が車自身を参照しているので、確保済みの容量（MaxEnemies）を超えて配列を動かさない
+				enemies.emplace_back(world, smokeEffect, sparkEffect, spawn.pos, Palette::Tomato, spawn.maxSpeed, spawn.velocity, spawn.delay);
+				enemies.back().setCollisionFilter(collision.enemyFilter());
+				enemies.back().setDrawId(enemies.size());
+				spawns_ << spawn;
+				matched_ << true;
+			}
+			else
+			{
+				++result.enemiesDropped;
+				continue;
+			}
+
+			++result.enemiesChanged;
+		}
+
+		// 余った古い敵は枠を空ける
+		for (size_t i = 0; i < spawns_.size(); ++i)
+		{
+			if (spawns_[i] && not matched_[i])
+			{
+				enemies[i].removeAsEnemy();
+				spawns_[i].reset();
+				++result.enemiesChanged;
+			}
+		}
+
+		// 末尾の空いた枠は取り除く（末尾なので、ほかの車は動かない）
+		while (not spawns_.isEmpty() && not spawns_.back())
+		{
+			enemies.pop_back();
+			spawns_.pop_back();
+		}
+	}
+
+	void remember(const StageDefinition& def)
+	{
+		walls_.assign(def.walls.begin(), def.walls.end());
+		goal_ = def.goal;
+	}
+
+	DirectoryWatcher watcher_;
+	FilePath path_;
+
+	// 今反映されている定義
+	Array<RectF> walls_;
+	Array<uint32> ids_;
+	uint32 nextId_ = 0;
+	RectF goal_;
+
+	// 敵の枠ごとの配置（none は空いた枠。enemies と同じ並び）
+	Array<Optional<EnemySpawn>> spawns_;
+	size_t enemiesDroppedOnLoad_ = 0;
+
+	// 差分を求めるときの作業用
+	Array<StageStreamer::WallChange> changes_;
+	Array<uint32> newIds_;
+	Array<bool> matched_;
+	Array<bool> newMatched_;
+	Array<size_t> oldOrder_;
+	Array<size_t> newOrder_;
+};
+
+// 1 サブステップ分、ステージを進める（inputs はプレイヤーごと）
+void StepStage(P2World& world, std::span<Car> players, Array<Car>& enemies, std::span<const InputState> inputs, bool paused)
+{
+	for (size_t i = 0; i < players.size(); ++i)
+	{
+		players[i].updateAsPlayer(StepSec, inputs[i], paused);
+	}
+
+	for (auto& e : enemies)
+	{
+		e.updateAsEnemy(StepSec, 0);
+	}
+
+	world.update(StepSec);
+
+	Car::UpdatePoses(players, enemies);
+
+	// 壊れた敵の剛体を解放
+	for (auto& e : enemies)
+	{
+		if (e.alive() && e.life() <= 0)
+		{
+			e.releaseBody();
+		}
+	}
+}
+
+void StepStage(P2World& world, Car& player, Array<Car>& enemies, const InputState& input, bool paused)
+{
+	StepStage(world, std::span{ &player, 1 }, enemies, std::span{ &input, 1 }, paused);
+}
+
+// シミュレーション状態のスナップショット
+// 剛体の値は Box2D の内部で float なので 32 ビットで、それ以外の double は 64 ビットのまま、32 ビットの語の列に詰める
+namespace WorldSnapshot
+{
+	inline void PushFloat(Array<uint32>& words, double value)
+	{
+		words << std::bit_cast<uint32>(static_cast<float>(value));
+	}
+
+	inline void PushDouble(Array<uint32>& words, double value)
+	{
+		const uint64 bits = std::bit_cast<uint64>(value);
+		words << static_cast<uint32>(bits >> 32) << static_cast<uint32>(bits);
+	}
+
+	inline void PushInt64(Array<uint32>& words, int64 value)
+	{
+		words << static_cast<uint32>(static_cast<uint64>(value) >> 32) << static_cast<uint32>(value);
+	}
+
+	inline double PopFloat(const uint32*& it)
+	{
+		return std::bit_cast<float>(*it++);
+	}
+
+	inline double PopDouble(const uint32*& it)
+	{
+		const uint64 bits = (static_cast<uint64>(it[0]) << 32) | it[1];
+		it += 2;
+		return std::bit_cast<double>(bits);
+	}
+
+	inline int64 PopInt64(const uint32*& it)
+	{
+		const uint64 bits = (static_cast<uint64>(it[0]) << 32) | it[1];
+		it += 2;
+		return static_cast<int64>(bits);
+	}
+
+	// 全ての車の状態とステージの経過時間、エフェクトの乱数の状態を語の列にする
+	inline void Capture(const Car& player, const Array<Car>& enemies, int64 stageTimeUs, Array<uint32>& words)
+	{
+		words.clear();
+		PushInt64(words, stageTimeUs);
+		PushInt64(words, static_cast<int64>(EffectRandom::State()));
+
+		const auto pushCar = [&](const Car& car)
+			{
+				const Car::State s = car.state();
+				PushFloat(words, s.pos.x);
+				PushFloat(words, s.pos.y);
+				PushFloat(words, s.angle);
+				PushFloat(words, s.velocity.x);
+				PushFloat(words, s.velocity.y);
+				PushFloat(words, s.angularVelocity);
+				PushDouble(words, s.life);
+				PushDouble(words, s.tireAngle);
+				PushDouble(words, s.collidedSec);
+				PushDouble(words, s.smokeCooldownSec);
+				PushDouble(words, s.sparkCooldownSec);
+				words << static_cast<uint32>(s.elapsedSteps) << static_cast<uint32>(s.alive);
+			};
+
+		pushCar(player);
+
+		for (const auto& e : enemies)
+		{
+			pushCar(e);
+		}
+	}
+
+	// 語の列から全ての車の状態とエフェクトの乱数の状態を戻し、ステージの経過時間を返す
+	inline int64 Restore(const Array<uint32>& words, Car& player, Array<Car>& enemies)
+	{
+		const uint32* it = words.data();
+		const int64 stageTimeUs = PopInt64(it);
+		EffectRandom::State() = static_cast<uint64>(PopInt64(it));
+
+		const auto popCar = [&](Car& car)
+			{
+				Car::State s;
+				s.pos.x = PopFloat(it);
+				s.pos.y = PopFloat(it);
+				s.angle = PopFloat(it);
+				s.velocity.x = PopFloat(it);
+				s.velocity.y = PopFloat(it);
+				s.angularVelocity = PopFloat(it);
+				s.life = PopDouble(it);
+				s.tireAngle = PopDouble(it);
+				s.collidedSec = PopDouble(it);
+				s.smokeCooldownSec = PopDouble(it);
+				s.sparkCooldownSec = PopDouble(it);
+				s.elapsedSteps = static_cast<int32>(*it++);
+				s.alive = (*it++ != 0);
+				car.restore(s);
+			};
+
+		popCar(player);
+
+		for (auto& e : enemies)
+		{
+			popCar(e);
+		}
+
+		return stageTimeUs;
+	}
+
+	inline void WriteVarint(Array<uint8>& out, size_t value)
+	{
+		while (value >= 0x80)
+		{
+			out << static_cast<uint8>(value | 0x80);
+			value >>= 7;
+		}
+
+		out << static_cast<uint8>(value);
+	}
+
+	inline size_t ReadVarint(const uint8*& it)
+	{
+		size_t value = 0;
+
+		for (int32 shift = 0; ; shift += 7)
+		{
+			const uint8 byte = *it++;
+			value |= static_cast<size_t>(byte & 0x7F) << shift;
+
+			if (byte < 0x80) return value;
+		}
+	}
+
+	// 前のスナップショットとの XOR を取り、変化のない語の連続は長さだけ、変化した語は上位の 0 バイトを省いて書く
+	inline void EncodeDelta(const Array<uint32>& prev, const Array<uint32>& words, Array<uint8>& out)
+	{
+		size_t i = 0;
+
+		while (true)
+		{
+			size_t run = 0;
+
+			while ((i + run) < words.size() && (words[i + run] ^ prev[i + run]) == 0)
+			{
+				++run;
+			}
+
+			WriteVarint(out, run);
+			i += run;
+
+			if (i == words.size()) break;
+
+			const uint32 x = words[i] ^ prev[i];
+			const uint8 byteCount = (x <= 0xFF) ? 1 : (x <= 0xFFFF) ? 2 : (x <= 0xFFFFFF) ? 3 : 4;
+			out << byteCount;
+
+			for (uint8 b = 0; b < byteCount; ++b)
+			{
+				out << static_cast<uint8>(x >> (b * 8));
+			}
+
+			++i;
+		}
+	}
+
+	// prev に差分を適用する
+	inline void DecodeDelta(const Array<uint8>& data, Array<uint32>& words)
+	{
+		const uint8* it = data.data();
+		size_t i = 0;
+
+		while (true)
+		{
+			i += ReadVarint(it);
+
+			if (i == words.size()) break;
+
+			const uint8 byteCount = *it++;
+			uint32 x = 0;
+
+			for (uint8 b = 0; b < byteCount; ++b)
+			{
+				x |= static_cast<uint32>(*it++) << (b * 8);
+			}
+
+			words[i++] ^= x;
+		}
+	}
+}
+
+// スナップショットと入力の履歴（巻き戻し・リトライ用）
+// SnapshotInterval ティックごとに直前のスナップショットとの差分を記録し、KeyframeInterval ティックごとに単独で復元できるキーフレームを置く
+// 間のティックへは、直前のスナップショットから記録した入力でシミュレーションし直して戻る
+class StageHistory
+{
+public:
+	static constexpr int32 SnapshotInterval = 4;
+
+	static constexpr int32 KeyframeInterval = 400;
+
+	// 記録の容量の上限。超えたら古いキーフレームの区間から捨てる
+	static constexpr size_t ByteBudget = 8 * 1024 * 1024;
+
+	// 記録を消す。words はステージ開始時（tick 0）の状態で、リトライ用に別に取っておく
+	void reset(const Array<uint32>& words)
+	{
+		while (not entries_.empty())
+		{
+			recycle(entries_.back());
+			entries_.pop_back();
+		}
+
+		inputs_.clear();
+		inputBaseTick_ = 0;
+		byteSize_ = 0;
+		initial_ = words;
+		last_.assign(words.size(), 0);
+	}
+
+	static bool IsSnapshotTick(int32 tick)
+	{
+		return (tick % SnapshotInterval) == 0;
+	}
+
+	// tick のスナップショットを記録する（IsSnapshotTick(tick) のときだけ呼ぶ）
+	void recordSnapshot(int32 tick, const Array<uint32>& words)
+	{
+		// 巻き戻した直後は、そのティックのスナップショットが残っている
+		if (not entries_.empty() && entries_.back().tick >= tick) return;
+
+		const bool keyframe = entries_.empty() || (tick - lastKeyframeTick() >= KeyframeInterval);
+
+		Entry entry{ .tick = tick, .keyframe = keyframe };
+
+		// 捨てたスナップショットのバッファを使い回す
+		if (not spareData_.empty())
+		{
+			entry.data = std::move(spareData_.back());
+			spareData_.pop_back();
+			entry.data.clear();
+		}
+
+		if (keyframe)
+		{
+			last_.assign(words.size(), 0);
+		}
+
+		WorldSnapshot::EncodeDelta(last_, words, entry.data);
+		last_ = words;
+
+		byteSize_ += entry.data.size();
+		entries_.push_back(std::move(entry));
+
+		trim();
+	}
+
+	// tick に行った入力を記録する
+	void recordInput(int32 tick, const InputState& input, bool paused)
+	{
+		inputs_.resize(Max<size_t>(inputs_.size(), tick - inputBaseTick_ + 1));
+		inputs_[tick - inputBaseTick_] = static_cast<uint8>(input.up | (input.down << 1) | (input.left << 2) | (input.right << 3) | (paused << 4));
+	}
+
+	// tick に行った入力
+	std::pair<InputState, bool> input(int32 tick) const
+	{
+		const uint8 bits = inputs_[tick - inputBaseTick_];
+		return{ InputState{ (bits & 1) != 0, (bits & 2) != 0, (bits & 4) != 0, (bits & 8) != 0 }, (bits & 16) != 0 };
+	}
+
+	// tick 以前で最も新しいスナップショットを復元して words に入れ、そのティックを返す
+	Optional<int32> find(int32 tick, Array<uint32>& words) const
+	{
+		auto it = std::upper_bound(entries_.begin(), entries_.end(), tick, [](int32 t, const Entry& e) { return t < e.tick; });
+
+		if (it == entries_.begin()) return none;
+
+		--it;
+
+		// キーフレームまで遡ってから順に差分を適用する
+		auto key = it;
+
+		while (not key->keyframe)
+		{
+			--key;
+		}
+
+		words.assign(initial_.size(), 0);
+
+		for (auto e = key; e != std::next(it); ++e)
+		{
+			WorldSnapshot::DecodeDelta(e->data, words);
+		}
+
+		return it->tick;
+	}
+
+	// tick 以降の入力と、tick より後のスナップショットを捨てる（巻き戻した位置から記録を続けるため）
+	void truncateAfter(int32 tick)
+	{
+		while (not entries_.empty() && entries_.back().tick > tick)
+		{
+			byteSize_ -= entries_.back().data.size();
+			recycle(entries_.back());
+			entries_.pop_back();
+		}
+
+		inputs_.resize(Min<size_t>(inputs_.size(), Max(tick - inputBaseTick_, 0)));
+
+		if (not entries_.empty())
+		{
+			find(entries_.back().tick, last_);
+		}
+	}
+
+	const Array<uint32>& initial() const
+	{
+		return initial_;
+	}
+
+	int32 oldestTick() const
+	{
+		return entries_.empty() ? 0 : entries_.front().tick;
+	}
+
+	size_t byteSize() const
+	{
+		return byteSize_;
+	}
+
+private:
+	struct Entry
+	{
+		int32 tick;
+		bool keyframe;
+		Array<uint8> data;
+	};
+
+	void recycle(Entry& entry)
+	{
+		spareData_ << std::move(entry.data);
+	}
+
+	int32 lastKeyframeTick() const
+	{
+		for (auto it = entries_.rbegin(); it != entries_.rend(); ++it)
+		{
+			if (it->keyframe) return it->tick;
+		}
+
+		return 0;
+	}
+
+	// 容量を超えたら、先頭のキーフレームから次のキーフレームの直前までをまとめて捨てる
+	void trim()
+	{
+		while (byteSize_ > ByteBudget)
+		{
+			const auto next = std::find_if(std::next(entries_.begin()), entries_.end(), [](const Entry& e) { return e.keyframe; });
+
+			if (next == entries_.end()) return;
+
+			for (auto it = entries_.begin(); it != next; ++it)
+			{
+				byteSize_ -= it->data.size();
+				recycle(*it);
+			}
+
+			entries_.erase(entries_.begin(), next);
+
+			const int32 newBaseTick = entries_.front().tick;
+			inputs_.erase(inputs_.begin(), inputs_.begin() + (newBaseTick - inputBaseTick_));
+			inputBaseTick_ = newBaseTick;
+		}
+	}
+
+	// 古いものは先頭からまとめて捨てる
+	Array<Entry> entries_;
+	size_t byteSize_ = 0;
+
+	// 捨てたスナップショットのバッファ（容量を残したまま次の記録に使う）
+	Array<Array<uint8>> spareData_;
+
+	// ティックごとの入力（inputBaseTick_ から）
+	Array<uint8> inputs_;
+	int32 inputBaseTick_ = 0;
+
+	// 直前に記録したスナップショット（差分の基準）
+	Array<uint32> last_;
+
+	// ステージ開始時のスナップショット
+	Array<uint32> initial_;
+};
+
+// 描画を伴わないステージのシミュレーション（決定性の検証などに使う）
+// 壁はチャンクに分けず、全ての剛体をゲームと同じ順にその場で作成する
+class StageSimulation
+{
+public:
+	explicit StageSimulation(int stage)
+		: player_{ world_, smokeEffect_, sparkEffect_, Vec2::Zero(), Palette::White, 700 }
+	{
+		load(stage);
+	}
+
+	void load(int stage)
+	{
+		for (auto& e : enemies_)
+		{
+			e.releaseBody();
+		}
+		enemies_.clear();
+
+		for (auto& wall : walls_)
+		{
+			wall.body.release();
+		}
+		walls_.clear();
+
+		const StageDefinition def = MakeStageDefinition(stage);
+
+		// 前のステージのハンドルの向きなども含めて初期状態にする
+		player_.restore(Car::State{ .pos = def.playerPos, .life = 100, .alive = true });
+		player_.setLod(CarLod::Culled);
+		player_.disableEffects();
+		player_.setCollisionFilter(def.collision.playerFilter());
+
+		goal_.area = def.goal;
+		wallRects_.assign(def.walls.begin(), def.walls.end());
+
+		// 壁と敵はゲーム（LoadStage）と同じ順に作る
+		CreateWalls(world_, def.walls, def.collision.wallFilter(), walls_);
+
+		// Car はタイヤ跡の関数が this を参照するので、再確保されないよう先に確保しておく
+		enemies_.reserve(Min(def.enemies.size(), MaxEnemies));
+		SpawnEnemies(world_, smokeEffect_, sparkEffect_, def.enemies, def.collision.enemyFilter(), enemies_);
+
+		for (auto& e : enemies_)
+		{
+			e.setLod(CarLod::Culled);
+			e.disableEffects();
+		}
+
+		WorldSnapshot::Capture(player_, enemies_, 0, initial_);
+		tick_ = 0;
+	}
+
+	// ステージ開始時の状態に戻す（剛体は作り直さない）
+	void restart()
+	{
+		WorldSnapshot::Restore(initial_, player_, enemies_);
+		tick_ = 0;
+	}
+
+	// 全ての車の状態を語の列にする（経過時間は tick から）
+	void capture(Array<uint32>& words) const
+	{
+		WorldSnapshot::Capture(player_, enemies_, static_cast<int64>(tick_) * static_cast<int64>(StepSec * 1'000'000), words);
+	}
+
+	// capture() した状態に戻す。player を指定すればプレイヤーだけその状態にする
+	// 前の状態での接触が次のステップで判定されないよう、時間を進めずに接触だけ更新しておく
+	void restore(const Array<uint32>& words, const Optional<Car::State>& player = none)
+	{
+		tick_ = static_cast<int32>(WorldSnapshot::Restore(words, player_, enemies_) / static_cast<int64>(StepSec * 1'000'000));
+
+		if (player)
+		{
+			player_.restore(*player);
+		}
+
+		world_.update(0.0);
+	}
+
+	// プレイヤーの位置と向きを変える（速度などはそのまま）
+	void placePlayer(const Vec2& pos, double angle)
+	{
+		Car::State s = player_.state();
+		s.pos = pos;
+		s.angle = angle;
+		player_.restore(s);
+	}
+
+	// 1 サブステップ進める
+	void step(const InputState& input)
+	{
+		StepStage(world_, player_, enemies_, input, false);
+		++tick_;
+	}
+
+	const Car& player() const
+	{
+		return player_;
+	}
+
+	const Array<Car>& enemies() const
+	{
+		return enemies_;
+	}
+
+	const Goal& goal() const
+	{
+		return goal_;
+	}
+
+	const Array<RectF>& walls() const
+	{
+		return wallRects_;
+	}
+
+	int32 tick() const
+	{
+		return tick_;
+	}
+
+private:
+	P2World world_{ 0.0 };
+	EffectLayer smokeEffect_;
+	EffectLayer sparkEffect_;
+	Goal goal_;
+	StageArray<Wall> walls_;
+	Array<RectF> wallRects_;
+	Car player_;
+	Array<Car> enemies_;
+	Array<uint32> initial_;
+	int32 tick_ = 0;
+};
+
+// ゴールデン軌跡による決定性の検証
+// 各ステージを決まった入力で一定のサブステップ数だけ動かし、毎ティック全ての車の状態のハッシュを記録済みのものと比べる
+namespace GoldenTrajectory
+{
+	// 1 ステージあたりのサブステップ数（20 秒）
+	constexpr int32 TickCount = 4000;
+
+	inline FilePath GoldenPath(int stage)
+	{
+		return U"golden/stage{}.bin"_fmt(stage);
+	}
+
+	// 前進・旋回・後退を繰り返す決まった入力
+	inline InputState ScriptedInput(int32 tick)
+	{
+		const int32 t = tick % 800;
+
+		if (t < 300) return InputState{ .up = true };
+		if (t < 400) return InputState{ .up = true, .left = true };
+		if (t < 550) return InputState{ .down = true };
+		if (t < 650) return InputState{ .down = true, .right = true };
+		if (t < 750) return InputState{ .up = true, .right = true };
+		return InputState{};
+	}
+
+	// 車の姿勢・速度・耐久力のハッシュ（FNV-1a を 32 ビットに畳んだもの）
+	inline uint32 HashCar(const Car& car)
+	{
+		uint64 hash = 14695981039346656037ULL;
+
+		const auto mix = [&](double value)
+			{
+				const uint64 bits = std::bit_cast<uint64>(value);
+
+				for (int32 i = 0; i < 8; ++i)
+				{
+					hash = (hash ^ ((bits >> (i * 8)) & 0xFF)) * 1099511628211ULL;
+				}
+			};
+
+		mix(car.life());
+
+		// 壊れて剛体が解放された車は耐久力だけ
+		if (car.alive())
+		{
+			const Vec2 pos = car.pos();
+			const Vec2 velocity = car.velocity();
+			mix(pos.x);
+			mix(pos.y);
+			mix(car.angle());
+			mix(velocity.x);
+			mix(velocity.y);
+			mix(car.angularVelocity());
+		}
+
+		return static_cast<uint32>(hash ^ (hash >> 32));
+	}
+
+	struct Trajectory
+	{
+		// 1 ティックあたりの剛体数（プレイヤー + 敵）
+		uint32 bodyCount = 0;
+
+		// [tick * bodyCount + body]
+		Array<uint32> hashes;
+	};
+
+	inline Trajectory Run(int stage, double& elapsedMs)
+	{
+		const uint64 startUs = Time::GetMicrosec();
+
+		StageSimulation sim{ stage };
+
+		Trajectory trajectory;
+		trajectory.bodyCount = static_cast<uint32>(1 + sim.enemies().size());
+		trajectory.hashes.reserve(static_cast<size_t>(TickCount) * trajectory.bodyCount);
+
+		for (int32 tick = 0; tick < TickCount; ++tick)
+		{
+			sim.step(ScriptedInput(tick));
+
+			trajectory.hashes << HashCar(sim.player());
+
+			for (const auto& e : sim.enemies())
+			{
+				trajectory.hashes << HashCar(e);
+			}
+		}
+
+		elapsedMs = (Time::GetMicrosec() - startUs) / 1000.0;
+		return trajectory;
+	}
+
+	inline bool Write(const FilePath& path, const Trajectory& trajectory)
+	{
+		BinaryWriter writer{ path };
+
+		return writer
+			&& writer.write(trajectory.bodyCount)
+			&& writer.write(static_cast<uint32>(trajectory.hashes.size()))
+			&& writer.write(trajectory.hashes.data(), trajectory.hashes.size_bytes());
+	}
+
+	inline Optional<Trajectory> Read(const FilePath& path)
+	{
+		BinaryReader reader{ path };
+
+		Trajectory trajectory;
+		uint32 count = 0;
+
+		if (not reader || not reader.read(trajectory.bodyCount) || not reader.read(count))
+		{
+			return none;
+		}
+
+		trajectory.hashes.resize(count);
+
+		if (reader.read(trajectory.hashes.data(), trajectory.hashes.size_bytes()) != static_cast<int64>(trajectory.hashes.size_bytes()))
+		{
+			return none;
+		}
+
+		return trajectory;
+	}
+
+	// 全ステージを検証（record なら記録）し、結果を golden/report.txt とコンソールに出力する
+	// 全て一致したら true を返す
+	inline bool RunAll(bool record)
+	{
+		FileSystem::CreateDirectories(U"golden/");
+		TextWriter report{ U"golden/report.txt" };
+
+		const auto log = [&](const String& line)
+			{
+				report.writeln(line);
+				Console << line;
+			};
+
+		bool passed = true;
+		int32 missing = 0;
+
+		for (int stage = 1; stage <= StageCount; ++stage)
+		{
+			double elapsedMs = 0;
+			const Trajectory trajectory = Run(stage, elapsedMs);
+			const String timing = U"{} ticks in {:.1f}ms ({:.0f} ticks/s)"_fmt(TickCount, elapsedMs, TickCount / (elapsedMs / 1000.0));
+
+			if (record)
+			{
+				passed &= Write(GoldenPath(stage), trajectory);
+				log(U"STAGE {}: recorded, {}"_fmt(stage, timing));
+				continue;
+			}
+
+			const auto golden = Read(GoldenPath(stage));
+
+			if (not golden)
+			{
+				passed = false;
+				++missing;
+				log(U"STAGE {}: FAIL no golden at {}, {}"_fmt(stage, GoldenPath(stage), timing));
+				continue;
+			}
+
+			if (golden->bodyCount != trajectory.bodyCount || golden->hashes.size() != trajectory.hashes.size())
+			{
+				passed = false;
+				log(U"STAGE {}: FAIL shape changed ({} bodies x {} ticks, golden {} bodies x {} ticks), {}"_fmt(
+					stage, trajectory.bodyCount, trajectory.hashes.size() / trajectory.bodyCount,
+					golden->bodyCount, golden->hashes.size() / Max<uint32>(golden->bodyCount, 1), timing));
+				continue;
+			}
+
+			const auto mismatch = std::mismatch(trajectory.hashes.begin(), trajectory.hashes.end(), golden->hashes.begin());
+
+			if (mismatch.first != trajectory.hashes.end())
+			{
+				passed = false;
+				const size_t index = std::distance(trajectory.hashes.begin(), mismatch.first);
+				const size_t body = index % trajectory.bodyCount;
+				log(U"STAGE {}: FAIL first divergence at tick {}, body {} ({}), {}"_fmt(
+					stage, index / trajectory.bodyCount, body, (body == 0) ? U"player" : U"enemy {}"_fmt(body - 1), timing));
+				continue;
+			}
+
+			log(U"STAGE {}: OK, {}"_fmt(stage, timing));
+		}
+
+		// 基準が 1 つもないのは挙動の食い違いではなく、まだ記録していないだけ
+		if (missing == StageCount)
+		{
+			log(U"NO GOLDEN: record the baselines with --record-golden on a known-good build and commit golden/stage*.bin");
+		}
+
+		log(passed ? U"PASSED" : U"FAILED");
+		return passed;
+	}
+}
+
+// 常駐するワーカースレッドで、添字の範囲を分けて並列に処理する
+class WorkerPool
+{
+public:
+	// threadCount が 0 なら全ての論理コアを使う（呼び出し元のスレッドも 1 つとして数える）
+	explicit WorkerPool(size_t threadCount = 0)
+	{
+		const size_t total = (threadCount == 0) ? Max<size_t>(std::thread::hardware_concurrency(), 1) : threadCount;
+
+		for (size_t i = 1; i < total; ++i)
+		{
+			workers_.emplace_back([this](std::stop_token stopToken) { loop(stopToken); });
+		}
+	}
+
+	~WorkerPool()
+	{
+		for (auto& worker : workers_)
+		{
+			worker.request_stop();
+		}
+
+		// 条件変数より先にスレッドを終わらせる
+		workers_.clear();
+	}
+
+	size_t threadCount() const
+	{
+		return workers_.size() + 1;
+	}
+
+	// [0, count) を小分けにして全てのスレッドで func(begin, end) を呼び、全て終わるまで待つ
+	void run(size_t count, const std::function<void(size_t, size_t)>& func)
+	{
+		{
+			std::lock_guard lock{ mutex_ };
+			job_ = &func;
+			count_ = count;
+			grain_ = Max<size_t>(count / (threadCount() * 4), 1);
+			next_ = 0;
+			busy_ = workers_.size();
+			++generation_;
+		}
+
+		wakeCv_.notify_all();
+
+		work();
+
+		std::unique_lock lock{ mutex_ };
+		doneCv_.wait(lock, [this] { return busy_ == 0; });
+		job_ = nullptr;
+	}
+
+private:
+	void work()
+	{
+		while (true)
+		{
+			const size_t begin = next_.fetch_add(grain_);
+
+			if (begin >= count_) return;
+
+			(*job_)(begin, Min(begin + grain_, count_));
+		}
+	}
+
+	void loop(std::stop_token stopToken)
+	{
+		uint64 seen = 0;
+
+		while (true)
+		{
+			{
+				std::unique_lock lock{ mutex_ };
+
+				if (not wakeCv_.wait(lock, stopToken, [&] { return generation_ != seen; }))
+				{
+					return;
+				}
+
+				seen = generation_;
+			}
+
+			work();
+
+			{
+				std::lock_guard lock{ mutex_ };
+
+				if (--busy_ == 0)
+				{
+					doneCv_.notify_one();
+				}
+			}
+		}
+	}
+
+	Array<std::jthread> workers_;
+	std::mutex mutex_;
+	std::condition_variable_any wakeCv_;
+	std::condition_variable_any doneCv_;
+
+	const std::function<void(size_t, size_t)>* job_ = nullptr;
+	size_t count_ = 0;
+	size_t grain_ = 1;
+	std::atomic<size_t> next_ = 0;
+	size_t busy_ = 0;
+	uint64 generation_ = 0;
+};
+
+// 軸に平行な長方形の壁までの、半直線に沿った距離（当たらなければ maxDistance）
+double RayDistanceToWalls(const Vec2& origin, const Vec2& direction, const Array<RectF>& walls, double maxDistance)
+{
+	double nearest = maxDistance;
+
+	for (const auto& wall : walls)
+	{
+		// スラブ法
+		double tMin = 0.0;
+		double tMax = nearest;
+
+		for (int32 axis = 0; axis < 2; ++axis)
+		{
+			const double o = (axis == 0) ? origin.x : origin.y;
+			const double d = (axis == 0) ? direction.x : direction.y;
+			const double lo = (axis == 0) ? wall.x : wall.y;
+			const double hi = lo + ((axis == 0) ? wall.w : wall.h);
+
+			if (Abs(d) < 1e-9)
+			{
+				if (o < lo || hi < o)
+				{
+					tMin = Inf<double>;
+				}
+
+				continue;
+			}
+
+			double t0 = (lo - o) / d;
+			double t1 = (hi - o) / d;
+
+			if (t0 > t1)
+			{
+				std::swap(t0, t1);
+			}
+
+			tMin = Max(tMin, t0);
+			tMax = Min(tMax, t1);
+		}
+
+		if (tMin <= tMax)
+		{
+			nearest = tMin;
+		}
+	}
+
+	return nearest;
+}
+
+// 強化学習用の環境
+// 独立した多数のステージ（P2World + Car + Goal）を描画なしで持ち、全てのコアに分けて並列に進める
+// 行動は InputState を 4 ビット（上・下・左・右）に詰めたもの。エピソードが終わった個体はその場で次のエピソードを始める
+class ParkingEnv
+{
+public:
+	// 観測の要素数（個体ごと）
+	static constexpr size_t ObservationSize = 20;
+
+	// 1 回の step で同じ行動を続けるサブステップ数
+	static constexpr int32 ActionRepeat = 4;
+
+	// エピソードの長さの上限（サブステップ数、60 秒）
+	static constexpr int32 MaxEpisodeTicks = 12000;
+
+	// ゴールに完全に入ったまま、この時間が経てば駐車成功
+	static constexpr double ParkingSec = 1.0;
+
+	ParkingEnv(size_t instanceCount, size_t threadCount = 0)
+		: pool_{ threadCount }
+		, observations_(instanceCount * ObservationSize, 0.0f)
+		, rewards_(instanceCount, 0.0f)
+		, dones_(instanceCount, 0)
+	{
+		instances_.reserve(instanceCount);
+
+		for (size_t i = 0; i < instanceCount; ++i)
+		{
+			instances_ << std::make_unique<Instance>();
+		}
+	}
+
+	size_t size() const
+	{
+		return instances_.size();
+	}
+
+	size_t threadCount() const
+	{
+		return pool_.threadCount();
+	}
+
+	// 全ての個体を stage の最初に戻す。個体 i の開始位置は seed + i で少しずらす
+	void reset(int stage, uint64 seed)
+	{
+		// 同じステージなら剛体を作り直さず、初期状態を復元するだけ
+		for (auto& instance : instances_)
+		{
+			if (instance->stage != stage)
+			{
+				instance->sim = std::make_unique<StageSimulation>(stage);
+				instance->stage = stage;
+			}
+		}
+
+		pool_.run(instances_.size(), [&](size_t begin, size_t end)
+			{
+				for (size_t i = begin; i < end; ++i)
+				{
+					Instance& instance = *instances_[i];
+					instance.rng.seed(seed + i);
+
+					beginEpisode(instance);
+					observe(instance, observation(i));
+					rewards_[i] = 0.0f;
+					dones_[i] = 0;
+				}
+			});
+	}
+
+	// 全ての個体を 1 ステップ進める。actions は個体ごとに 1 バイト
+	void step(std::span<const uint8> actions)
+	{
+		pool_.run(instances_.size(), [&](size_t begin, size_t end)
+			{
+				for (size_t i = begin; i < end; ++i)
+				{
+					stepInstance(*instances_[i], actions[i], i);
+				}
+			});
+	}
+
+	// [個体][ObservationSize]
+	std::span<const float> observations() const
+	{
+		return observations_;
+	}
+
+	std::span<const float> rewards() const
+	{
+		return rewards_;
+	}
+
+	std::span<const uint8> dones() const
+	{
+		return dones_;
+	}
+
+private:
+	struct Instance
+	{
+		std::unique_ptr<StageSimulation> sim;
+		int stage = -1;
+		SmallRNG rng;
+		double parkedSec = 0;
+		double previousDistance = 0;
+		double previousLife = 0;
+	};
+
+	std::span<float> observation(size_t i)
+	{
+		return std::span{ observations_ }.subspan(i * ObservationSize, ObservationSize);
+	}
+
+	void beginEpisode(Instance& instance)
+	{
+		StageSimulation& sim = *instance.sim;
+		sim.restart();
+
+		// 開始位置と向きを少しずらす
+		const Vec2 offset = Circular{ Random(0.0, 8.0, instance.rng), Random(0.0, Math::TwoPi, instance.rng) }.toVec2();
+		sim.placePlayer(sim.player().pos() + offset, Random(-10_deg, 10_deg, instance.rng));
+
+		instance.parkedSec = 0;
+		instance.previousDistance = sim.player().pos().distanceFrom(sim.goal().area.center());
+		instance.previousLife = sim.player().life();
+	}
+
+	void stepInstance(Instance& instance, uint8 action, size_t i)
+	{
+		StageSimulation& sim = *instance.sim;
+		const InputState input = InputState::FromBits(action);
+
+		for (int32 k = 0; k < ActionRepeat; ++k)
+		{
+			sim.step(input);
+		}
+
+		const Car& player = sim.player();
+		const Goal& goal = sim.goal();
+
+		// ゴールに完全に入っている時間
+		const bool inGoal = goal.area.contains(player.bodyQuad());
+		instance.parkedSec = inGoal ? (instance.parkedSec + ActionRepeat * StepSec) : 0.0;
+
+		const bool parked = (instance.parkedSec >= ParkingSec);
+		const bool destroyed = (player.life() <= 0);
+		const bool timeout = (sim.tick() >= MaxEpisodeTicks);
+
+		// 報酬: ゴールに近づいた距離、受けたダメージ、経過時間、終了時のボーナスとペナルティ
+		const double distance = player.pos().distanceFrom(goal.area.center());
+		double reward = (instance.previousDistance - distance) / 100.0
+			- (instance.previousLife - player.life()) / 10.0
+			- 0.001;
+
+		if (parked) reward += 10.0;
+		if (destroyed) reward -= 10.0;
+
+		instance.previousDistance = distance;
+		instance.previousLife = player.life();
+
+		rewards_[i] = static_cast<float>(reward);
+		dones_[i] = (parked || destroyed || timeout);
+
+		if (dones_[i])
+		{
+			beginEpisode(instance);
+		}
+
+		observe(instance, observation(i));
+	}
+
+	// 観測: 車の座標系でのゴールの位置、向き、速度、ハンドル、耐久力、駐車の進み具合、経過時間、8 方向の壁までの距離
+	void observe(const Instance& instance, std::span<float> out) const
+	{
+		const StageSimulation& sim = *instance.sim;
+		const Car& player = sim.player();
+		const double angle = player.angle();
+		const Vec2 toGoal = (sim.goal().area.center() - player.pos()).rotated(-angle);
+		const Vec2 velocity = player.velocity().rotated(-angle);
+
+		size_t n = 0;
+		out[n++] = static_cast<float>(toGoal.x / 1000.0);
+		out[n++] = static_cast<float>(toGoal.y / 1000.0);
+		out[n++] = static_cast<float>(Math::Sin(angle));
+		out[n++] = static_cast<float>(Math::Cos(angle));
+		out[n++] = static_cast<float>(velocity.x / player.maxSpeed());
+		out[n++] = static_cast<float>(velocity.y / player.maxSpeed());
+		out[n++] = static_cast<float>(player.angularVelocity() / 10.0);
+		out[n++] = static_cast<float>(player.tireAngle() / 45_deg);
+		out[n++] = static_cast<float>(player.life() / 100.0);
+		out[n++] = static_cast<float>(instance.parkedSec / ParkingSec);
+		out[n++] = static_cast<float>(sim.goal().area.contains(player.bodyQuad()));
+		out[n++] = static_cast<float>(static_cast<double>(sim.tick()) / MaxEpisodeTicks);
+
+		constexpr double RayLength = 400.0;
+
+		for (int32 k = 0; k < 8; ++k)
+		{
+			const Vec2 direction = Circular{ 1.0, angle + k * 45_deg }.toVec2();
+			out[n++] = static_cast<float>(RayDistanceToWalls(player.pos(), direction, sim.walls(), RayLength) / RayLength);
+		}
+	}
+
+	WorkerPool pool_;
+	Array<std::unique_ptr<Instance>> instances_;
+	Array<float> observations_;
+	Array<float> rewards_;
+	Array<uint8> dones_;
+};
+
+// 学習環境のスループットの計測（--rl-bench）
+// ランダムな行動で全ステージを進め、環境ステップ毎秒を rl_bench.txt とコンソールに出力する
+void RunParkingEnvBenchmark()
+{
+	constexpr size_t InstanceCount = 256;
+	constexpr int32 StepCount = 1000;
+
+	ParkingEnv env{ InstanceCount };
+	SmallRNG rng{ 12345 };
+	Array<uint8> actions(InstanceCount, 0);
+
+	TextWriter report{ U"rl_bench.txt" };
+
+	const auto log = [&](const String& line)
+		{
+			report.writeln(line);
+			Console << line;
+		};
+
+	log(U"{} instances, {} threads, {} substeps per step"_fmt(env.size(), env.threadCount(), ParkingEnv::ActionRepeat));
+
+	for (int stage = 1; stage <= StageCount; ++stage)
+	{
+		const uint64 resetStartUs = Time::GetMicrosec();
+		env.reset(stage, 0);
+		const double resetMs = (Time::GetMicrosec() - resetStartUs) / 1000.0;
+
+		size_t episodes = 0;
+		const uint64 startUs = Time::GetMicrosec();
+
+		for (int32 i = 0; i < StepCount; ++i)
+		{
+			for (auto& action : actions)
+			{
+				action = static_cast<uint8>(Random(0, 15, rng));
+			}
+
+			env.step(actions);
+			episodes += std::count(env.dones().begin(), env.dones().end(), uint8{ 1 });
+		}
+
+		const double sec = (Time::GetMicrosec() - startUs) / 1'000'000.0;
+		log(U"STAGE {}: {:.0f} env-steps/s ({:.0f} substeps/s), {} episodes done, reset {:.1f}ms"_fmt(
+			stage, InstanceCount * StepCount / sec, InstanceCount * StepCount * ParkingEnv::ActionRepeat / sec, episodes, resetMs));
+	}
+}
+
+// 1 サブステップごとの運転操作の列（プランナーが書き出し、--play で再生する）
+struct InputTrack
+{
+	// InputState::toBits() の値
+	Array<uint8> actions;
+
+	// 終わった後は何も操作しない
+	InputState at(int32 tick) const
+	{
+		return InRange<int64>(tick, 0, static_cast<int64>(actions.size()) - 1) ? InputState::FromBits(actions[tick]) : InputState{};
+	}
+
+	bool save(const FilePath& path) const
+	{
+		BinaryWriter writer{ path };
+
+		return writer
+			&& writer.write(static_cast<uint32>(actions.size()))
+			&& writer.write(actions.data(), actions.size_bytes());
+	}
+
+	static Optional<InputTrack> Load(const FilePath& path)
+	{
+		BinaryReader reader{ path };
+
+		InputTrack track;
+		uint32 count = 0;
+
+		if (not reader || not reader.read(count))
+		{
+			return none;
+		}
+
+		track.actions.resize(count);
+
+		if (reader.read(track.actions.data(), track.actions.size_bytes()) != static_cast<int64>(track.actions.size_bytes()))
+		{
+			return none;
+		}
+
+		return track;
+	}
+};
+
+// 壁までの距離場
+// 格子の各セルの中心から最も近い壁までの距離を前もって求めておき、衝突判定をセルを引くだけで済ませる
+class DistanceField
+{
+public:
+	static constexpr double CellSize = 4.0;
+
+	void build(std::span<const RectF> walls, const RectF& area, WorkerPool& pool)
+	{
+		origin_ = area.pos;
+		size_ = Size{ static_cast<int32>(Math::Ceil(area.w / CellSize)), static_cast<int32>(Math::Ceil(area.h / CellSize)) };
+		distances_.assign(static_cast<size_t>(size_.x) * size_.y, 0.0f);
+
+		pool.run(size_.y, [&](size_t begin, size_t end)
+			{
+				for (size_t y = begin; y < end; ++y)
+				{
+					for (int32 x = 0; x < size_.x; ++x)
+					{
+						const Vec2 center = origin_ + Vec2{ x + 0.5, y + 0.5 } * CellSize;
+						double nearest = Inf<double>;
+
+						for (const auto& wall : walls)
+						{
+							const double dx = Max(Max(wall.x - center.x, center.x - (wall.x + wall.w)), 0.0);
+							const double dy = Max(Max(wall.y - center.y, center.y - (wall.y + wall.h)), 0.0);
+							nearest = Min(nearest, Vec2{ dx, dy }.length());
+						}
+
+						distances_[y * size_.x + x] = static_cast<float>(nearest);
+					}
+				}
+			});
+	}
+
+	// pos から最も近い壁までの距離の下限（格子の外は壁から十分離れているので Inf）
+	double at(const Vec2& pos) const
+	{
+		const Vec2 local = (pos - origin_) / CellSize;
+
+		if (local.x < 0 || local.y < 0 || size_.x <= local.x || size_.y <= local.y)
+		{
+			return Inf<double>;
+		}
+
+		// セル内のどこにあっても、中心との差はセルの対角線の半分まで
+		return distances_[static_cast<int32>(local.y) * size_.x + static_cast<int32>(local.x)] - CellSize * Math::Sqrt2 / 2;
+	}
+
+	size_t cellCount() const
+	{
+		return distances_.size();
+	}
+
+private:
+	Vec2 origin_{ 0, 0 };
+	Size size_{ 0, 0 };
+	Array<float> distances_;
+};
+
+// 最速の駐車経路の探索
+// 9 通りの操作（前進・後退・なし × 左・右・まっすぐ）を 0.1 秒ずつ続けたものを枝とする Hybrid A* 風の探索で、
+// 車のモデル（ハンドル ±45°、前後の力、減衰）はゲームと同じ物理演算そのものを使い、ゴールに完全に入って 1 秒留まるまでの入力列を求める
+// 枝のうち壁や敵に触れたものは捨てる。敵の動きはプレイヤーに触れない限り入力によらないので、
+// プレイヤーを遠ざけて一度だけ流した敵の状態を時刻ごとに使い回す
+class MotionPlanner
+{
+public:
+	// 1 つの操作を続けるサブステップ数（0.1 秒）
+	static constexpr int32 PrimitiveTicks = 20;
+
+	// ゴールに完全に入ったまま留まるサブステップ数（1 秒）
+	static constexpr int32 DwellTicks = 200;
+
+	// 探索する時間の上限（60 秒）
+	static constexpr int32 MaxPlanTicks = 12000;
+
+	// 展開するノード数の上限
+	static constexpr size_t MaxExpansions = 100'000;
+
+	// ヒューリスティックの重み（1 より大きいと、最適解のこの倍以内の解を速く見つける）
+	static constexpr double HeuristicWeight = 1.5;
+
+	// 同じ状態とみなす格子の刻み（位置、向きとハンドル、前後の速さ）
+	static constexpr double CellSize = 8.0;
+	static constexpr double AngleStep = 15_deg;
+	static constexpr double SpeedStep = 100.0;
+
+	// 壁との間に空ける隙間
+	static constexpr double Clearance = 1.0;
+
+	struct Result
+	{
+		bool found = false;
+
+		// ゴールに 1 秒留まり終えたサブステップ（クリアタイム）
+		int32 parkedTick = 0;
+
+		InputTrack track;
+		size_t expansions = 0;
+		size_t nodes = 0;
+		double fieldMs = 0;
+		double enemyMs = 0;
+		double searchMs = 0;
+	};
+
+	// threadCount が 0 なら全ての論理コアを使う
+	explicit MotionPlanner(size_t threadCount = 0)
+		: pool_{ threadCount } {}
+
+	static FilePath TrackPath(int stage)
+	{
+		return U"plans/stage{}.bin"_fmt(stage);
+	}
+
+	Result plan(int stage)
+	{
+		Result result;
+		const StageDefinition def = MakeStageDefinition(stage);
+		goal_ = def.goal;
+
+		// 壁までの距離場
+		{
+			const uint64 startUs = Time::GetMicrosec();
+			field_.build(def.walls, FieldArea(def), pool_);
+			result.fieldMs = (Time::GetMicrosec() - startUs) / 1000.0;
+		}
+
+		// スレッドごとのシミュレーション
+		sims_.clear();
+
+		for (size_t i = 0; i < pool_.threadCount(); ++i)
+		{
+			sims_ << std::make_unique<StageSimulation>(stage);
+		}
+
+		// プレイヤーがいないときの敵の動き（操作の区切りごと）
+		{
+			const uint64 startUs = Time::GetMicrosec();
+			StageSimulation& sim = *sims_.front();
+			sim.placePlayer(Vec2{ -100000, -100000 }, 0);
+
+			timeline_.resize(MaxPlanTicks / PrimitiveTicks + 1);
+
+			for (auto& words : timeline_)
+			{
+				sim.capture(words);
+
+				for (int32 i = 0; i < PrimitiveTicks; ++i)
+				{
+					sim.step(InputState{});
+				}
+			}
+
+			sim.restart();
+			result.enemyMs = (Time::GetMicrosec() - startUs) / 1000.0;
+		}
+
+		const uint64 startUs = Time::GetMicrosec();
+		maxSpeed_ = sims_.front()->player().maxSpeed();
+
+		Array<Node> nodes;
+		Node root{ .state = sims_.front()->player().state() };
+		root.f = HeuristicWeight * heuristic(root.state, 0);
+		nodes << root;
+
+		// (f, ノードの添字) の小さい順。同じ f なら先に作られたノードから展開するので、スレッド数によらず同じ結果になる
+		std::priority_queue<std::pair<double, uint32>, std::vector<std::pair<double, uint32>>, std::greater<>> open;
+		open.emplace(root.f, 0);
+
+		HashSet<uint64> closed;
+		Array<uint32> batch;
+		Array<Optional<Node>> children;
+		Optional<Node> best;
+
+		// f の小さい順にスレッド数の数倍のノードをまとめて取り出し、並列に展開する
+		const size_t batchSize = sims_.size() * 2;
+
+		while (not open.empty() && result.expansions < MaxExpansions && not best)
+		{
+			batch.clear();
+
+			while (not open.empty() && batch.size() < batchSize)
+			{
+				const uint32 index = open.top().second;
+				open.pop();
+
+				if (closed.insert(Key(nodes[index])).second)
+				{
+					batch << index;
+				}
+			}
+
+			children.assign(batch.size() * ActionCount, none);
+
+			pool_.run(sims_.size(), [&](size_t begin, size_t end)
+				{
+					for (size_t t = begin; t < end; ++t)
+					{
+						for (size_t j = t; j < batch.size(); j += sims_.size())
+						{
+							for (int32 action = 0; action < ActionCount; ++action)
+							{
+								children[j * ActionCount + action] = expand(*sims_[t], nodes[batch[j]], batch[j], action);
+							}
+						}
+					}
+				});
+
+			result.expansions += batch.size();
+
+			for (const auto& child : children)
+			{
+				if (not child) continue;
+
+				if (DwellTicks <= child->parkedTicks)
+				{
+					if (not best || child->tick < best->tick)
+					{
+						best = child;
+					}
+
+					continue;
+				}
+
+				if (MaxPlanTicks <= child->tick || closed.contains(Key(*child))) continue;
+
+				nodes << *child;
+				open.emplace(child->f, static_cast<uint32>(nodes.size() - 1));
+			}
+		}
+
+		result.nodes = nodes.size();
+		result.searchMs = (Time::GetMicrosec() - startUs) / 1000.0;
+
+		if (best)
+		{
+			result.found = true;
+			result.parkedTick = best->tick;
+			result.track = MakeTrack(nodes, *best);
+		}
+
+		return result;
+	}
+
+	// 入力列を最初から再生し、壁や敵に触れずにゴールに 1 秒留まれるかを確かめる
+	static bool Verify(int stage, const InputTrack& track)
+	{
+		StageSimulation sim{ stage };
+		const double life = sim.player().life();
+		int32 parkedTicks = 0;
+
+		for (int32 tick = 0; tick < static_cast<int32>(track.actions.size()); ++tick)
+		{
+			sim.step(track.at(tick));
+
+			if (sim.player().life() < life)
+			{
+				return false;
+			}
+
+			parkedTicks = sim.goal().area.contains(sim.player().bodyQuad()) ? (parkedTicks + 1) : 0;
+		}
+
+		return (DwellTicks <= parkedTicks);
+	}
+
+private:
+	static constexpr int32 ActionCount = 9;
+
+	// 車体の長方形を覆う円（車体の向きに沿って並べる）
+	static constexpr int32 FootprintCircles = 3;
+	static constexpr double FootprintStep = Car::BodySize.y / FootprintCircles;
+	static inline const double FootprintRadius = Vec2{ Car::BodySize.x / 2, FootprintStep / 2 }.length();
+
+	struct Node
+	{
+		Car::State state;
+		int32 tick = 0;
+		int32 parkedTicks = 0;
+		int32 parent = -1;
+		uint8 action = 0;
+		double f = 0;
+	};
+
+	static InputState ActionInput(int32 action)
+	{
+		const int32 throttle = action / 3;
+		const int32 steering = action % 3;
+		return InputState{ .up = (throttle == 1), .down = (throttle == 2), .left = (steering == 1), .right = (steering == 2) };
+	}
+
+	// 距離場の範囲（壁・ゴール・スタート地点を囲む長方形に余白をつけたもの）
+	static RectF FieldArea(const StageDefinition& def)
+	{
+		Vec2 tl = def.playerPos;
+		Vec2 br = def.playerPos;
+
+		const auto extend = [&](const RectF& rect)
+			{
+				tl = Vec2{ Min(tl.x, rect.x), Min(tl.y, rect.y) };
+				br = Vec2{ Max(br.x, rect.x + rect.w), Max(br.y, rect.y + rect.h) };
+			};
+
+		extend(def.goal);
+
+		for (const auto& wall : def.walls)
+		{
+			extend(wall);
+		}
+
+		constexpr double Margin = 64.0;
+		return RectF{ tl - Vec2::All(Margin), (br - tl) + Vec2::All(Margin * 2) };
+	}
+
+	// 車体を覆う円が全て壁から離れているか
+	bool isFree(const Vec2& pos, double angle) const
+	{
+		for (int32 k = 0; k < FootprintCircles; ++k)
+		{
+			const Vec2 center = pos + Circular{ (k - (FootprintCircles - 1) / 2.0) * FootprintStep, angle }.toVec2();
+
+			if (field_.at(center) <= FootprintRadius + Clearance)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// 残りの時間の見積もり: ゴールまでの直線距離を最高速度で進む時間と、残りの待ち時間
+	double heuristic(const Car::State& s, int32 parkedTicks) const
+	{
+		const double distance = Max(s.pos.distanceFrom(goal_.center()) - Car::BodySize.x, 0.0);
+		return distance / maxSpeed_ + (DwellTicks - parkedTicks) * StepSec;
+	}
+
+	// 同じ状態とみなす格子のキー（位置、向き、前後の速さ、ハンドル、ゴールの中にいるか）
+	static uint64 Key(const Node& node)
+	{
+		const Car::State& s = node.state;
+		const uint64 x = static_cast<uint64>(static_cast<int64>(Math::Floor(s.pos.x / CellSize))) & 0xFFFF;
+		const uint64 y = static_cast<uint64>(static_cast<int64>(Math::Floor(s.pos.y / CellSize))) & 0xFFFF;
+		const double heading = s.angle - Math::TwoPi * Math::Floor(s.angle / Math::TwoPi);
+		const uint64 h = static_cast<uint64>(heading / AngleStep) & 0xFF;
+		const double forwardSpeed = s.velocity.dot(Circular{ 1.0, s.angle }.toVec2());
+		const uint64 v = static_cast<uint64>(Clamp<int64>(static_cast<int64>(Math::Round(forwardSpeed / SpeedStep)), -7, 7) + 7);
+		const uint64 tire = static_cast<uint64>(static_cast<int64>(Math::Round(s.tireAngle / AngleStep)) + 3) & 0xFF;
+		return (x << 48) | (y << 32) | (h << 24) | (v << 16) | (tire << 8) | static_cast<uint64>(0 < node.parkedTicks);
+	}
+
+	// node から action を 0.1 秒続ける。壁や敵に触れたら none
+	// ゴールに 1 秒留まり終えたら、そのサブステップで止める
+	Optional<Node> expand(StageSimulation& sim, const Node& node, uint32 index, int32 action) const
+	{
+		sim.restore(timeline_[node.tick / PrimitiveTicks], node.state);
+
+		const InputState input = ActionInput(action);
+		int32 parkedTicks = node.parkedTicks;
+
+		for (int32 i = 0; i < PrimitiveTicks; ++i)
+		{
+			sim.step(input);
+
+			const Car& player = sim.player();
+
+			if (player.life() < node.state.life || not isFree(player.pos(), player.angle()))
+			{
+				return none;
+			}
+
+			parkedTicks = goal_.contains(player.bodyQuad()) ? (parkedTicks + 1) : 0;
+
+			if (DwellTicks <= parkedTicks)
+			{
+				break;
+			}
+		}
+
+		Node child{
+			.state = sim.player().state(),
+			.tick = sim.tick(),
+			.parkedTicks = parkedTicks,
+			.parent = static_cast<int32>(index),
+			.action = input.toBits(),
+		};
+		child.f = child.tick * StepSec + HeuristicWeight * heuristic(child.state, parkedTicks);
+		return child;
+	}
+
+	// ゴールのノードから根までたどり、サブステップごとの入力列にする
+	static InputTrack MakeTrack(const Array<Node>& nodes, const Node& last)
+	{
+		InputTrack track;
+		track.actions.resize(last.tick);
+
+		for (const Node* node = &last; node->parent != -1; node = &nodes[node->parent])
+		{
+			for (int32 tick = nodes[node->parent].tick; tick < node->tick; ++tick)
+			{
+				track.actions[tick] = node->action;
+			}
+		}
+
+		return track;
+	}
+
+	WorkerPool pool_;
+	Array<std::unique_ptr<StageSimulation>> sims_;
+	DistanceField field_;
+	Array<Array<uint32>> timeline_;
+	RectF goal_;
+	double maxSpeed_ = 1.0;
+};
+
+// 全ステージの最速の駐車経路を求め（--plan）、入力列を plans/ に、結果を plans/report.txt とコンソールに出力する
+void RunMotionPlanner()
+{
+	FileSystem::CreateDirectories(U"plans/");
+	TextWriter report{ U"plans/report.txt" };
+
+	const auto log = [&](const String& line)
+		{
+			report.writeln(line);
+			Console << line;
+		};
+
+	MotionPlanner planner;
+
+	for (int stage = 1; stage <= StageCount; ++stage)
+	{
+		const MotionPlanner::Result result = planner.plan(stage);
+		const double totalMs = result.fieldMs + result.enemyMs + result.searchMs;
+		const String timing = U"{} expansions, {} nodes, planning {:.1f}ms (distance field {:.1f}ms, enemies {:.1f}ms, search {:.1f}ms)"_fmt(
+			result.expansions, result.nodes, totalMs, result.fieldMs, result.enemyMs, result.searchMs);
+
+		if (not result.found)
+		{
+			log(U"STAGE {}: no plan found, {}"_fmt(stage, timing));
+			continue;
+		}
+
+		const bool saved = result.track.save(MotionPlanner::TrackPath(stage));
+		const bool verified = MotionPlanner::Verify(stage, result.track);
+
+		log(U"STAGE {}: {:.2f}s ({} ticks), replay {}, {}{}"_fmt(
+			stage, result.parkedTick * StepSec, result.parkedTick, verified ? U"OK" : U"DIVERGED", timing,
+			saved ? U" -> {}"_fmt(MotionPlanner::TrackPath(stage)) : U""));
+	}
+}
+
+// 描画リスト（分割画面では全ての画面で共有する）
+// 1 フレームに 1 回だけ要素を格子に振り分けて並べ替えておき、画面ごとには見える範囲の格子だけを二分探索で引く
+class DrawGrid
+{
+public:
+	// 格子の一辺
+	static constexpr double CellSize = 128.0;
+
+	void clear()
+	{
+		entries_.clear();
+		large_.clear();
+	}
+
+	// 格子より大きいもの（長い壁など）は格子に入れず、画面ごとに 1 つずつ判定する
+	void add(uint32 index, const RectF& bounds)
+	{
+		if (bounds.w > CellSize || bounds.h > CellSize)
+		{
+			large_ << Large{ index, bounds };
+			return;
+		}
+
+		entries_ << Entry{ CellKey(CellCoord(bounds.center())), index };
+	}
+
+	// add() し終えたら呼ぶ
+	void finish()
+	{
+		entries_.sort_by([](const Entry& a, const Entry& b) { return (a.cell != b.cell) ? (a.cell < b.cell) : (a.index < b.index); });
+	}
+
+	// view と重なりうる要素の index を fn に渡す
+	template <class Fn>
+	void query(const RectF& view, Fn&& fn) const
+	{
+		for (const auto& large : large_)
+		{
+			if (large.bounds.intersects(view))
+			{
+				fn(large.index);
+			}
+		}
+
+		// 格子に入れたものは一辺が CellSize 以下なので、中心が view を CellSize / 2 広げた範囲になければ重ならない
+		const RectF area = view.stretched(CellSize / 2);
+		const Point minCoord = CellCoord(area.tl());
+		const Point maxCoord = CellCoord(area.br());
+
+		for (int32 y = minCoord.y; y <= maxCoord.y; ++y)
+		{
+			for (int32 x = minCoord.x; x <= maxCoord.x; ++x)
+			{
+				const uint64 key = CellKey(Point{ x, y });
+				auto it = std::lower_bound(entries_.begin(), entries_.end(), key, [](const Entry& e, uint64 k) { return e.cell < k; });
+
+				for (; it != entries_.end() && it->cell == key; ++it)
+				{
+					fn(it->index);
+				}
+			}
+		}
+	}
+
+private:
+	struct Entry
+	{
+		uint64 cell;
+		uint32 index;
+	};
+
+	struct Large
+	{
+		uint32 index;
+		RectF bounds;
+	};
+
+	static Point CellCoord(const Vec2& pos)
+	{
+		return Point{ static_cast<int32>(Math::Floor(pos.x / CellSize)), static_cast<int32>(Math::Floor(pos.y / CellSize)) };
+	}
+
+	static uint64 CellKey(const Point& coord)
+	{
+		return (static_cast<uint64>(static_cast<uint32>(coord.y)) << 32) | static_cast<uint32>(coord.x);
+	}
+
+	Array<Entry> entries_;
+	Array<Large> large_;
+};
+
+// ゴールに 1 秒間収まり続けたら駐車とする判定
+class ParkingJudge
+{
+public:
+	// 毎フレーム呼び、駐車できていれば true を返す
+	bool update(bool inGoal)
+	{
+		if (not inGoal)
+		{
+			timer_.reset();
+			return false;
+		}
+
+		if (not timer_.isRunning())
+		{
+			timer_.restart();
+		}
+
+		return (timer_ > 1s);
+	}
+
+	// ゴールに収まっていて、判定している最中か
+	bool judging() const
+	{
+		return timer_.isRunning();
+	}
+
+	void reset()
+	{
+		timer_.reset();
+	}
+
+private:
+	Stopwatch timer_;
+};
+
+// 地面（ステージごとの色と、タイリングしたテクスチャ）
+class Ground
+{
+public:
+	Ground()
+		: texture_{ Image{ Resource(U"example/texture/ground.jpg") }.grayscale().threshold(100) }
+	{
+	}
+
+	// 背景全体の色（0 はタイトル）
+	Color color(int stage) const
+	{
+		return colors_[stage];
+	}
+
+	// 画面に映る範囲だけ、原点を中心とした 40000x40000 のタイリングと同じ位置合わせで描く
+	void draw(const RectF& view) const
+	{
+		const ScopedRenderStates2D sampler{ SamplerState::RepeatNearest };
+		texture_(view.x + 20000, view.y + 20000, view.w, view.h).draw(view.pos, AlphaF(0.1));
+	}
+
+private:
+	Texture texture_;
+
+	std::array<Color, 4> colors_{
+		Palette::Darkkhaki.lerp(Palette::Black, 0.5),
+		Palette::Darkslategray.lerp(Palette::Black, 0.5),
+		Palette::Darkgreen.lerp(Palette::Black, 0.5),
+		Palette::Darkred.lerp(Palette::Black, 0.5),
+	};
+};
+
+// プレイヤーを追従するカメラ（ズームアウトのキーを押している間は縮小し、離すと戻す）
+class FollowCamera
+{
+public:
+	static constexpr double MinZoom = 0.65;
+
+	// baseScale: ズームしていないときの拡大率（分割画面では画面の大きさに合わせて小さくする）
+	FollowCamera(const Vec2& pos, double baseScale)
+		: camera_{ pos, baseScale, Parameters() }
+		, baseScale_{ baseScale }
+	{
+	}
+
+	void zoom(bool zoomOut, double deltaSec)
+	{
+		zoom_ = Clamp(zoom_ + (zoomOut ? -2.0 : 6.0) * deltaSec, MinZoom, 1.0);
+		camera_.setScale(scale());
+	}
+
+	void follow(const Vec2& target)
+	{
+		camera_.setTargetCenter(target);
+		camera_.update();
+	}
+
+	void jumpTo(const Vec2& pos)
+	{
+		camera_.jumpTo(pos, scale());
+	}
+
+	double scale() const
+	{
+		return baseScale_ * zoom_;
+	}
+
+	// いちばんズームアウトしたときの拡大率
+	double minScale() const
+	{
+		return baseScale_ * MinZoom;
+	}
+
+	Vec2 center() const
+	{
+		return camera_.getCenter();
+	}
+
+	// 回転しても画面に収まるよう、画面の対角の長さの正方形を見える範囲とする
+	RectF visibleRect(const SizeF& viewSize) const
+	{
+		return RectF{ Arg::center = camera_.getCenter(), viewSize.length() / camera_.getScale() + 32 };
+	}
+
+	Transformer2D createTransformer() const
+	{
+		return camera_.createTransformer();
+	}
+
+private:
+	static Camera2DParameters Parameters()
+	{
+		auto param = Camera2DParameters::NoControl();
+		param.positionSmoothTime = 0.05;
+		return param;
+	}
+
+	Camera2D camera_;
+	double baseScale_;
+	double zoom_ = 1.0;
+};
+
+// 物理演算のサブステップが表す時刻（このフレームで進める残りのサブステップの分だけ、フレームの時刻より前）
+inline uint64 SubstepTimeUs(uint64 frameTimeUs, double accumulatorSec)
+{
+	return frameTimeUs - static_cast<uint64>((accumulatorSec - StepSec) * 1'000'000);
+}
+
+// ステージのタイム（表示は 1/100 秒単位なので、その値が変わったときだけ描き直す）
+void DrawStageTime(HudLabel& label, const Stopwatch& timeStage)
+{
+	const int64 centisec = timeStage.ms() / 10;
+	label.update(centisec, Padded{ centisec / 6000, 2 }, U":", Padded{ (centisec / 100) % 60, 2 }, U".", Padded{ centisec % 100, 2 });
+	label.drawAt(SceneCenter.movedBy(0, -118));
+}
+
+// ゲーム画面と分割画面で共有する、1 つのステージを遊ぶためのもの（ワールド・壁・敵・エフェクトと描画リスト）
+// 剛体やタイヤ跡がワールドや自分自身を参照しているので、作った後に動かさない
+struct StageSession
+{
+	StageSession()
+	{
+		enemies.reserve(MaxEnemies);
+	}
+
+	// ステージを読み込み、player をスタート地点に置く
+	void load(int stage, Car& player, StageHotReloader* hotReloader = nullptr)
+	{
+		// ステージ用のアリーナを使っているものを先に手放してから、アリーナをまとめて捨てる
+		streamer.clear();
+		stageArena.reset();
+
+		// 定義は剛体と敵を作るまでしか使わないので、アリーナではなく通常のヒープに置いて、ここで捨てる
+		const StageDefinition def = hotReloader ? hotReloader->load(stage, std::pmr::get_default_resource()) : MakeStageDefinition(stage);
+		LoadStage(stage, def, world, streamer, enemies, player, goal, collisionRules, minimap, smokeEffect, sparkEffect);
+	}
+
+	// エフェクトの時間を進める（そのフレームのシミュレーションより前に、1 フレームに 1 回呼ぶ）
+	void updateEffects(double deltaSec)
+	{
+		smokeEffect.update(deltaSec);
+		sparkEffect.update(deltaSec);
+	}
+
+	void clearEffects()
+	{
+		smokeEffect.clear();
+		sparkEffect.clear();
+	}
+
+	// 敵の詳細度を、いちばん近くに映っている画面で決める
+	void updateLods(std::span<const FollowCamera> cameras)
+	{
+		for (auto& e : enemies)
+		{
+			if (not e.alive()) continue;
+
+			CarLod lod = CarLod::Culled;
+
+			for (const auto& camera : cameras)
+			{
+				const CarLod viewLod = ChooseCarLod(e.pos().distanceFrom(camera.center()) * camera.scale(), Car::BodySize.y * camera.scale());
+				lod = Min(lod, viewLod);
+			}
+
+			e.setLod(lod);
+		}
+	}
+
+	// 描画リストを 1 フレームに 1 回だけ作る（チャンクの読み込みと詳細度の更新の後に呼ぶ）
+	void buildDrawLists()
+	{
+		wallGrid.clear();
+		enemyGrid.clear();
+
+		for (const auto& [i, rect] : Indexed(streamer.visibleWalls()))
+		{
+			wallGrid.add(static_cast<uint32>(i), rect);
+		}
+
+		for (const auto& [i, e] : Indexed(enemies))
+		{
+			if (e.alive() && e.lod() != CarLod::Culled)
+			{
+				enemyGrid.add(static_cast<uint32>(i), e.bodyQuad().boundingRect());
+			}
+		}
+
+		wallGrid.finish();
+		enemyGrid.finish();
+	}
+
+	// 1 つの画面に、見える範囲 view の要素だけを描く（カメラとプレイヤーの向きの変換の中で呼ぶ）
+	// goalHighlighted: ゴールの枠を緑にする
+	void draw(const Ground& ground, std::span<const Car> players, const RectF& view, bool goalHighlighted, uint64 frame) const
+	{
+		goal.draw(goalHighlighted);
+		ground.draw(view);
+
+		const Array<RectF>& walls = streamer.visibleWalls();
+		wallGrid.query(view, [&](uint32 index) { walls[index].draw(Palette::Whitesmoke); });
+
+		smokeEffect.draw(view);
+
+		for (const auto& player : players)
+		{
+			player.draw(frame);
+		}
+
+		enemyGrid.query(view, [&](uint32 index) { enemies[index].draw(frame); });
+
+		sparkEffect.draw(view);
+	}
+
+	// ステージの間だけ使うもの（壁の剛体とその id の配列。ステージ切り替えでまとめて捨てる）
+	MonotonicArena stageArena{ 256 * 1024 };
+
+	// 2D 物理演算のワールド
+	P2World world{ 0.0 };
+
+	Goal goal;
+
+	// 当たり判定のフィルタ
+	CollisionRules collisionRules;
+
+	Minimap minimap;
+
+	// 壁（剛体の配列はステージ用のアリーナに置き、描画はチャンク単位で読み込む）
+	StageStreamer streamer{ world, &stageArena };
+
+	EffectLayer smokeEffect, sparkEffect;
+
+	// 敵（タイヤ跡が自分を参照しているので、作った後に動かさない）
+	Array<Car> enemies;
+
+	// 1 フレームに 1 回作る描画リスト
+	DrawGrid wallGrid, enemyGrid;
+};
+
+// 分割画面の対戦（--players 2～4）
+// 全員が同じステージで最初に駐車するのを競う。プレイヤーどうしは当たらない
+void RunSplitScreen(int32 playerCount, RenderTexture& renderTexture, double scale, FramePacer& pacer)
+{
+	const std::span<const PlayerKeys> keys{ SplitScreenKeys.data(), static_cast<size_t>(playerCount) };
+	const std::array<Color, 4> playerColors{ Palette::White, Palette::Skyblue, Palette::Gold, Palette::Violet };
+
+	// 画面の割り当て（2 人なら左右、3～4 人なら 4 分割）と、画面の大きさに合わせた基本のズーム
+	Array<Rect> viewports;
+
+	if (playerCount == 2)
+	{
+		viewports = { Rect{ 0, 0, SceneWidth / 2, SceneHeight }, Rect{ SceneWidth / 2, 0, SceneWidth / 2, SceneHeight } };
+	}
+	else
+	{
+		for (int32 i : step(playerCount))
+		{
+			viewports << Rect{ (i % 2) * SceneWidth / 2, (i / 2) * SceneHeight / 2, SceneWidth / 2, SceneHeight / 2 };
+		}
+	}
+
+	const double baseZoom = (playerCount == 2) ? 0.8 : 0.6;
+
+	const Font font = FontAsset(U"Title");
+	HudLabel timeLabel{ font, 12, Vec2{ 1, 1 } }, resultLabel{ font, 12, Vec2{ 1, 1 } }, wreckedLabel{ font, 12, Vec2{ 1, 1 } };
+	wreckedLabel.update(0, U"WRECKED");
+	Array<HudLabel> playerLabels;
+	playerLabels.reserve(playerCount);
+
+	// 運転操作の入力（全員のキーをまとめてサンプリングし、プレイヤーごとにサブステップへ振り分ける）
+	InputSampler inputSampler{ keys };
+	Array<InputTimeline> inputTimelines(playerCount);
+	InputLatencyMeter inputLatency;
+	Array<InputEvent> inputEvents;
+
+	StageSession session;
+	const Ground ground;
+
+	// タイヤ跡が自分を参照しているので、作った後に動かさない
+	Array<Car> players;
+	players.reserve(playerCount);
+
+	for (int32 i : step(playerCount))
+	{
+		players.emplace_back(session.world, session.smokeEffect, session.sparkEffect, Vec2{ 128, 128 }, playerColors[i], 700);
+		playerLabels.emplace_back(font, 12, Vec2{ 1, 1 });
+	}
+
+	Array<FollowCamera> cameras(playerCount, FollowCamera{ Vec2{ 128, 128 }, baseZoom });
+	Array<RenderTexture> viewTextures;
+
+	for (const auto& viewport : viewports)
+	{
+		viewTextures.emplace_back(viewport.size);
+	}
+
+	int stage = 1;
+	Stopwatch timeStage;
+	Stopwatch timeShowResult;
+	Array<ParkingJudge> judges(playerCount);
+	Optional<int32> winner;
+	Array<int32> wins(playerCount, 0);
+	double accumulatorSec = 0.0;
+	int32 simTick = 0;
+	Array<InputState> inputs(playerCount);
+	Array<Vec2> centers(playerCount);
+
+	// プレイヤーどうしは当たらないので、全員同じ位置から出発する
+	const auto loadStage = [&](int s)
+		{
+			session.load(s, players[0]);
+
+			for (auto [i, player] : Indexed(players))
+			{
+				player.hideTrails();
+				player.resetLife();
+				player.reset(players[0].pos());
+				player.setCollisionFilter(session.collisionRules.playerFilter());
+				player.setDrawId(session.enemies.size() + 1 + i);
+				judges[i].reset();
+				cameras[i].jumpTo(player.pos());
+			}
+
+			session.clearEffects();
+
+			simTick = 0;
+			accumulatorSec = 0;
+			winner.reset();
+			timeShowResult.reset();
+			timeStage.restart();
+		};
+
+	loadStage(stage);
+
+	while (System::Update())
+	{
+		pacer.wait();
+
+		inputEvents.clear();
+		inputSampler.collect(inputEvents);
+
+		for (auto [i, timeline] : Indexed(inputTimelines))
+		{
+			timeline.push(inputEvents, static_cast<int32>(i));
+		}
+
+		// ESC キーで終了
+		if (KeyEscape.down())
+		{
+			return;
+		}
+
+		// R キーでステージの最初からやり直す
+		if (KeyR.down())
+		{
+			loadStage(stage);
+		}
+
+		// 駐車の判定（最初に 1 秒間ゴールに収まったプレイヤーの勝ち）と、全員壊れたかの判定
+		if (not timeShowResult.isRunning())
 		{
-			for (const auto& contact : collision)
-			{
-				const auto velocity = body_.getVelocity();
+			bool anyAlive = false;
 
-				if (timerSpark_.reachedZero() && velocity.length() > 4.0)
+			for (auto [i, player] : Indexed(players))
+			{
+				if (player.life() <= 0)
 				{
-					timerSpark_.restart();
+					judges[i].reset();
+					continue;
+				}
 
-					for (int i : step(Random(1, 2)))
-					{
-						sparkEffect_.add<SparkEffect>(contact.point, velocity.length());
-					}
+				anyAlive = true;
+
+				if (judges[i].update(session.goal.area.contains(player.bodyQuad())) && not winner)
+				{
+					winner = static_cast<int32>(i);
+					++wins[i];
 				}
 			}
 
-			if (not timerCollided_.isRunning() && (pair.a == body_.id() || pair.b == body_.id()))
+			if (winner || not anyAlive)
 			{
-				timerCollided_.restart(0.3s);
+				timeStage.pause();
+				timeShowResult.restart();
 			}
 		}
-
-		// 接触ダメージ
-		if (timerCollided_.isRunning())
+		else if (timeShowResult > 3s)
 		{
-			if (life_ > 0)
-			{
-				life_ -= damage * stepSec;
-
-				if (life_ <= 0)
-				{
-					// 爆発エフェクト
-					sparkEffect_.add<ExplodeEffect>(body_.getPos());
-				}
-			}
+			stage = (stage % StageCount) + 1;
+			loadStage(stage);
+			continue;
 		}
-	}
 
-	void generateSmoke(double scale = 1.0)
-	{
-		if (timerSmoke_.reachedZero())
+		session.updateEffects(Scene::DeltaTime());
+
+		// 2D 物理演算のワールドを更新（サブステップごとに、その時刻までに起きた入力を反映）
+		const uint64 frameTimeUs = Time::GetMicrosec();
+
+		for (accumulatorSec += Scene::DeltaTime(); (StepSec <= accumulatorSec); accumulatorSec -= StepSec)
 		{
-			timerSmoke_.restart(SecondsF{ Random(0.001, 0.1) });
+			const uint64 substepTimeUs = SubstepTimeUs(frameTimeUs, accumulatorSec);
 
-			for (int i : step(Random(1, 3)))
+			for (auto [i, player] : Indexed(players))
 			{
-				smokeEffect_.add<SmokeEffect>(pos() + Circular{ 12.0, angle() + 180_deg }, angle() + tireAngle_, scale);
+				const InputState& input = inputTimelines[i].advanceTo(substepTimeUs, inputLatency);
+				inputs[i] = (player.life() > 0) ? input : InputState{};
 			}
 
-			if (body_.getVelocity().length() > 1.0)
-			{
-				for (int iTire : step(4))
-				{
-					smokeEffect_.add<SmokeEffect>(tirePos_(iTire) + RandomVec2(2.0), angle() + tireAngle_ * 0.3, 0.3 * scale);
-				}
-			}
+			StepStage(session.world, players, session.enemies, inputs, false);
+			++simTick;
 		}
-	}
 
-	void updateTireTrail(double stepSec)
-	{
-		for (auto& t : trails_)
+		// プレイヤーごとのカメラとズーム
+		for (auto [i, camera] : Indexed(cameras))
 		{
-			t.update(stepSec);
+			camera.zoom(keys[i].zoomOut.pressed(), Scene::DeltaTime());
+			camera.follow(players[i].pos());
+			centers[i] = players[i].pos();
 		}
-	}
 
-	// タイヤの位置
-	// index: 0-3 (時計回り)
-	Vec2 tirePos_(int index) const
-	{
-		switch (index)
+		// 全てのプレイヤーの周囲のチャンクを読み込む
+		session.streamer.update(centers, StageStreamer::LoadRadius(cameras[0].minScale()));
+
+		// 敵の詳細度と描画リストは、全ての画面で共有する
+		session.updateLods(cameras);
+		session.buildDrawLists();
+
+		// 画面ごとに、見える範囲の要素だけを描く
+		for (auto [i, viewTexture] : Indexed(viewTextures))
 		{
-		case 0: return pos() + Circular{ 12, angle() - 35_deg };
-		case 1: return pos() + Circular{ 12, angle() + 35_deg };
-		case 2: return pos() + Circular{ 12, angle() + 145_deg };
-		case 3: return pos() + Circular{ 12, angle() + 215_deg };
-		}
-		return pos();
-	}
+			const ScopedRenderTarget2D renderTarget{ viewTexture.clear(ground.color(stage)) };
+			const FollowCamera& camera = cameras[i];
+			const Car& player = players[i];
 
-private:
-	P2World& world_;
-	Effect& smokeEffect_;
-	Effect& sparkEffect_;
-	Color color_;
-	double maxSpeed_;
-	Circular enemyVelocity_;
-	double delay_ = 0;
-	Stopwatch time_;
-	P2Body body_;
+			{
+				const auto cameraTr = camera.createTransformer();
+				const Transformer2D rotTr(Mat3x2::Rotate(-player.angle(), player.pos()));
 
-	// タイヤの向き
-	double tireAngle_ = 0;
+				session.draw(ground, players, camera.visibleRect(viewTexture.size()), judges[i].judging(), simTick);
+			}
 
-	// エフェクト用タイマー
-	Timer timerSmoke_;
-	Timer timerSpark_;
-	Timer timerCollided_;
+			// プレイヤー番号と勝ち数
+			playerLabels[i].update(wins[i], U"P", i + 1, U" WINS ", wins[i]);
+			playerLabels[i].drawAt(Vec2{ viewTexture.width() / 2.0, viewTexture.height() - 12.0 }, playerColors[i]);
 
-	// タイヤの跡
-	Array<TrailMotion> trails_;
-	Timer timerHideTrails_;
+			if (player.life() <= 0)
+			{
+				wreckedLabel.drawAt(Vec2{ viewTexture.width() / 2.0, viewTexture.height() / 2.0 }, ColorF{ 1.0, 0.5 + 0.5 * Periodic::Square0_1(0.4s) });
+			}
+		}
 
-	// 耐久力
-	double life_ = 100;
-	bool alive_ = true;
+		{
+			const ScopedRenderTarget2D renderTarget{ renderTexture.clear(ColorF{ 0.0 }) };
 
-	static inline constexpr SizeF BodySize{ 16, 28 };
-	static inline constexpr SizeF TireSize{ 6, 8 };
-};
+			for (auto [i, viewport] : Indexed(viewports))
+			{
+				viewTextures[i].draw(viewport.pos);
+				viewport.drawFrame(1, 0, ColorF{ 0.0 });
+			}
 
-struct Wall
-{
-	P2Body body;
-	RectF rect;
-};
+			// タイム
+			DrawStageTime(timeLabel, timeStage);
 
-struct Goal
-{
-	RectF area;
-	Color color;
-	static inline constexpr SizeF Size{ 48, 64 };
-};
+			// 結果
+			if (timeShowResult.isRunning())
+			{
+				if (winner)
+				{
+					resultLabel.update(*winner, U"P", *winner + 1, U" PARKED!");
+				}
+				else
+				{
+					resultLabel.update(-1, U"ALL WRECKED");
+				}
 
-void RemoveEnemies(Array<Car>& enemies)
-{
-	for (auto& e : enemies)
-	{
-		e.releaseBody();
-	}
-	enemies.clear();
-}
+				RectF{ Arg::center = SceneCenter, 256, 20 }.draw(ColorF{ 0, 0.8 });
+				resultLabel.drawAt(SceneCenter, winner ? ColorF{ playerColors[*winner] } : ColorF{ 1.0 });
+			}
+		}
 
-void RemoveWalls(Array<Wall>& walls)
-{
-	for (auto& w : walls)
-	{
-		w.body.release();
+		{
+			const Transformer2D scaler{ Mat3x2::Scale(scale) };
+			renderTexture.draw();
+		}
 	}
-	walls.clear();
-}
-
-void AddWall(P2World& world, Array<Wall>& walls, const RectF& rect)
-{
-	walls << Wall{ world.createRect(P2Static, rect.center(), rect.size, {}, {}), rect };
 }
 
-void LoadStage(int stage, P2World& world, Array<Wall>& walls, Array<Car>& enemies, Car& player, Goal& goal, Effect& smokeEffect, Effect& sparkEffect)
+void Main()
 {
-	RemoveEnemies(enemies);
-	RemoveWalls(walls);
-
-	player.hideTrails();
-	player.resetLife();
-
-	if (stage == 1)
+	// 決定性の検証（--verify-golden）と、その基準の記録（--record-golden）
+	if (const auto& args = System::GetCommandLineArgs(); args.includes(U"--verify-golden") || args.includes(U"--record-golden"))
 	{
-		player.reset(Vec2{ 128, 128 });
-
-		goal.area = RectF{ Arg::center = Vec2{ 400, 128 }, Goal::Size };
-
-		AddWall(world, walls, RectF{ Arg::center = Vec2{ 128, 16 }, 40000, 8 });
-		AddWall(world, walls, RectF{ Arg::center = Vec2{ 128, 256 - 16 }, 40000, 8 });
-		AddWall(world, walls, RectF{ Arg::center = Vec2{ -250, 128 }, 8, 256 - 16 });
+		// CI で検出できるよう、食い違ったとき（基準がないときも含む）は 0 以外の終了コードで終わる
+		if (not GoldenTrajectory::RunAll(args.includes(U"--record-golden")))
+		{
+			std::exit(EXIT_FAILURE);
+		}
 
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ -160, 128 }, Palette::Tomato, 900, Circular{ 1500, 90_deg });
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ -120, 128 }, Palette::Tomato, 900, Circular{ 1500, 90_deg });
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ -80, 128 }, Palette::Tomato, 900, Circular{ 1500, 90_deg });
+		return;
 	}
-	else if (stage == 2)
+
+	// 学習環境のスループットの計測
+	if (System::GetCommandLineArgs().includes(U"--rl-bench"))
 	{
-		player.reset(Vec2{ 1150, 632 });
-
-		goal.area = RectF{ 999, 601, Goal::Size };
-
-		AddWall(world, walls, RectF{ 1072, 465, 8, 904 });
-		AddWall(world, walls, RectF{ 1244, 351, 360, 348 });
-		AddWall(world, walls, RectF{ 1053, 805, 741, 8 });
-		AddWall(world, walls, RectF{ 1774, 516, 8, 310 });
-		AddWall(world, walls, RectF{ 80, 366, 1976, 8 });
-		AddWall(world, walls, RectF{ 252, 1739, 534, 8 });
-		AddWall(world, walls, RectF{ 766, 351, 8, 1404 });
-		AddWall(world, walls, RectF{ 909, 471, 8, 1458 });
-		AddWall(world, walls, RectF{ 67, 1910, 877, 8 });
-		AddWall(world, walls, RectF{ 84, 1552, 8, 381 });
-		AddWall(world, walls, RectF{ 906, 466, 183, 8 });
-		AddWall(world, walls, RectF{ 67, 1571, 534, 8 });
-		AddWall(world, walls, RectF{ 1051, 1021, 754, 8 });
-		AddWall(world, walls, RectF{ 2032, 348, 8, 1211 });
-		AddWall(world, walls, RectF{ 583, 962, 8, 644 });
-		AddWall(world, walls, RectF{ 560, 974, 231, 8 });
-		AddWall(world, walls, RectF{ 890, 1526, 1158, 8 });
-		AddWall(world, walls, RectF{ 1774, 1002, 8, 393 });
-		AddWall(world, walls, RectF{ 1244, 1196, 360, 348 });
+		RunParkingEnvBenchmark();
+		return;
 	}
-	else if (stage == 3)
-	{
-		player.reset(Vec2{ 1100, 616 });
-
-		goal.area = RectF{ 1073, 425, Goal::Size.yx() };
-
-		AddWall(world, walls, RectF{ 255, 510, 1949, 64 });
-		AddWall(world, walls, RectF{ 494, 760, 1995, 61 });
-		AddWall(world, walls, RectF{ -13, 8, 2839, 319 });
-		AddWall(world, walls, RectF{ 968, 236, 61, 389 });
-		AddWall(world, walls, RectF{ 2144, 453, 61, 318 });
-		AddWall(world, walls, RectF{ 243, 1026, 1938, 61 });
-		AddWall(world, walls, RectF{ 2428, 798, 61, 550 });
-		AddWall(world, walls, RectF{ 242, 510, 61, 841 });
-		AddWall(world, walls, RectF{ 678, 942, 137, 136 });
-		AddWall(world, walls, RectF{ 1281, 938, 137, 136 });
-		AddWall(world, walls, RectF{ 993, 1041, 137, 136 });
-		AddWall(world, walls, RectF{ 1721, 1044, 137, 136 });
-		AddWall(world, walls, RectF{ 541, 1287, 1938, 61 });
-		AddWall(world, walls, RectF{ -13, 1547, 2839, 270 });
-		AddWall(world, walls, RectF{ 2765, 22, 61, 1782 });
-		AddWall(world, walls, RectF{ -12, 22, 61, 1782 });
-		AddWall(world, walls, RectF{ 1000, 1469, 137, 136 });
-		AddWall(world, walls, RectF{ 1459, 1302, 137, 136 });
-		AddWall(world, walls, RectF{ 1941, 1454, 137, 136 });
-		AddWall(world, walls, RectF{ 2347, 400, 281, 231 });
-		AddWall(world, walls, RectF{ 2620, 1405, 182, 201 });
-		AddWall(world, walls, RectF{ 2100, 986, 137, 136 });
-		AddWall(world, walls, RectF{ 1319, 437, 271, 123 });
-		AddWall(world, walls, RectF{ 1737, 262, 271, 136 });
-
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 2060, 660 }, Palette::Tomato, 900, Circular{ 3000, -90_deg });
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 1860, 660 }, Palette::Tomato, 900, Circular{ 3000, -90_deg });
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 1660, 660 }, Palette::Tomato, 900, Circular{ 3000, -90_deg });
-
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 2358, 878 }, Palette::Tomato, 900, Circular{ 3500, -90_deg }, 5.0);
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 2158, 888 }, Palette::Tomato, 900, Circular{ 3500, -90_deg }, 5.0);
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 1958, 848 }, Palette::Tomato, 900, Circular{ 3500, -90_deg }, 5.0);
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 1758, 878 }, Palette::Tomato, 900, Circular{ 3500, -90_deg }, 5.0);
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 1558, 858 }, Palette::Tomato, 900, Circular{ 3500, -90_deg }, 5.0);
-
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 364, 1238 }, Palette::Tomato, 900, Circular{ 4000, 90_deg }, 14.0);
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 564, 1228 }, Palette::Tomato, 900, Circular{ 4000, 90_deg }, 13.0);
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 764, 1248 }, Palette::Tomato, 900, Circular{ 4000, 90_deg }, 12.0);
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 964, 1238 }, Palette::Tomato, 900, Circular{ 4000, 90_deg }, 11.0);
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 1164, 1228 }, Palette::Tomato, 900, Circular{ 4000, 90_deg }, 10.0);
-
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 130, 417 }, Palette::Tomato, 900, Circular{ 5000, 180_deg }, 25.0);
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 95, 407 }, Palette::Tomato, 900, Circular{ 5000, 180_deg }, 25.0);
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 155, 407 }, Palette::Tomato, 900, Circular{ 5000, 180_deg }, 25.0);
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 120, 617 }, Palette::Tomato, 900, Circular{ 5100, 180_deg }, 22.0);
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 95, 607 }, Palette::Tomato, 900, Circular{ 5100, 180_deg }, 22.0);
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 165, 607 }, Palette::Tomato, 900, Circular{ 5100, 180_deg }, 22.0);
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 130, 817 }, Palette::Tomato, 900, Circular{ 5200, 180_deg }, 20.0);
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 95, 807 }, Palette::Tomato, 900, Circular{ 5200, 180_deg }, 20.0);
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 155, 807 }, Palette::Tomato, 900, Circular{ 5200, 180_deg }, 20.0);
-
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 2619, 729 }, Palette::Tomato, 900, Circular{ 6400, 180_deg }, 33.5 - 2.0);
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 2649, 729 }, Palette::Tomato, 900, Circular{ 6400, 180_deg }, 34.0 - 2.0);
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 2589, 729 }, Palette::Tomato, 900, Circular{ 6400, 180_deg }, 34.5 - 2.0);
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 2619, 829 }, Palette::Tomato, 900, Circular{ 6400, 180_deg }, 29.5 - 2.0);
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 2649, 829 }, Palette::Tomato, 900, Circular{ 6400, 180_deg }, 30.0 - 2.0);
-		enemies.emplace_back(world, smokeEffect, sparkEffect, Vec2{ 2589, 829 }, Palette::Tomato, 900, Circular{ 6400, 180_deg }, 30.5-2.0);
 
-	}
-	else if (stage == 0)
+	// 最速の駐車経路の探索
+	if (System::GetCommandLineArgs().includes(U"--plan"))
 	{
-		player.reset(Vec2{ 128, 128 });
-
-		goal.area = RectF{};
+		RunMotionPlanner();
+		return;
 	}
-}
 
-void Main()
-{
 	Scene::SetBackground(ColorF{ 0 });
 
 	Window::SetTitle(U"PARKING v1.0.0");
@@ -625,59 +5419,72 @@ void Main()
 	const double scale = ini.getOr<double>(U"WindowScale", 2.0);
 	Window::Resize((SceneSize * scale).asPoint());
 
+	// フレームレートを config.ini から読み込み（0 なら vsync に任せる）
+	FramePacer pacer{ ini.getOr<double>(U"TargetFPS", 0.0) };
+
 	// アセット
 	FontAsset::Register(U"Title", 12, Resource(U"font/x8y12pxTheStrongGamer.ttf"), FontStyle::Bitmap);
+	const Font font = FontAsset(U"Title");
 
-	// 2D 物理演算のシミュレーション
-	constexpr double StepSec = 1.0 / 200.0;
-	double accumulatorSec = 0.0;
+	// 分割画面の対戦（--players 2～4）
+	if (const auto& args = System::GetCommandLineArgs(); args.includes(U"--players"))
+	{
+		const auto it = std::next(std::find(args.begin(), args.end(), U"--players"));
+		const int32 playerCount = (it != args.end()) ? ParseOr<int32>(*it, 2) : 2;
+		RunSplitScreen(Clamp(playerCount, 2, 4), renderTexture, scale, pacer);
+		return;
+	}
 
-	// 2D 物理演算のワールド
-	P2World world{ 0.0 };
+	// 1 フレームの間だけ使うもの（HUD の文字列など）のアリーナ（ステージ用のアリーナは StageSession が持つ）
+	MonotonicArena frameArena{ 64 * 1024 };
+
+	// 1 フレームあたりのヒープ確保の回数を数える基準
+	uint64 lastAllocationCount = AllocationCounter::Count();
+
+	// HUD の文字列（内容が変わったときだけテクスチャに描き直す）
+	HudLabel titleLabel{ font, 24 }, pressEnterLabel{ font, 12 }, bestRecordLabel{ font, 12 };
+	HudLabel timeLabel{ font, 12, Vec2{ 1, 1 } }, stageLabel{ font, 12, Vec2{ 1, 1 } }, recordLabel{ font, 12, Vec2{ 1, 1 } };
+	HudLabel menuLabel{ font, 12 }, cancelLabel{ font, 12 }, okLabel{ font, 12 };
+	HudLabel gameoverLabel{ font, 24, Vec2{ 2, 2 } }, retryLabel{ font, 12 };
+	titleLabel.update(0, U"PARKING");
+	pressEnterLabel.update(0, U"PRESS ENTER");
+	menuLabel.update(0, U"RETURN TO TITLE?");
+	cancelLabel.update(0, U"CANCEL");
+	okLabel.update(0, U"OK (TO TITLE)");
+	gameoverLabel.update(0, U"GAME OVER");
+	retryLabel.update(0, U"R: RETRY  BS: REWIND");
+	uint64 lastHudRenderCount = HudLabel::RenderCount();
 
-	// ゴール
-	Goal goal;
+	// 2D 物理演算のシミュレーション
+	double accumulatorSec = 0.0;
 
-	// 壁
-	Array<Wall> walls;
-	//Array<P2Body> walls;
-	walls.reserve(100);
+	// 運転操作の入力
+	InputSampler inputSampler;
+	InputTimeline inputTimeline;
+	InputLatencyMeter inputLatency;
+	Array<InputEvent> inputEvents;
 
-	// 各種エフェクト
-	Effect smokeEffect, sparkEffect;
+	// ワールド・ゴール・壁・敵・エフェクト（分割画面と共通）
+	StageSession session;
+	P2World& world = session.world;
+	Array<Car>& enemies = session.enemies;
+	StageStreamer& streamer = session.streamer;
 
 	// プレイヤー
-	Car player{ world, smokeEffect, sparkEffect, Vec2{ 128, 128 }, Palette::White, 700 };
-
-	// 敵
-	Array<Car> enemies;
-	enemies.reserve(100);
+	Car player{ world, session.smokeEffect, session.sparkEffect, Vec2{ 128, 128 }, Palette::White, 700 };
 
 	// 2D カメラ
-	double zoom = 1.0;
-	auto cameraParam = Camera2DParameters::NoControl();
-	cameraParam.positionSmoothTime = 0.05;
-	Camera2D camera{ player.pos(), 1.0, cameraParam };
-
-	// 地面のテクスチャ
-	const auto groundImage = Image{ Resource(U"example/texture/ground.jpg") }.grayscale().threshold(100);
-	const Texture groundTexture{ groundImage };
+	FollowCamera camera{ player.pos(), 1.0 };
 
-	// 地面の色
-	std::array<Color, 4> groundColor = {
-		Palette::Darkkhaki.lerp(Palette::Black, 0.5),
-		Palette::Darkslategray.lerp(Palette::Black, 0.5),
-		Palette::Darkgreen.lerp(Palette::Black, 0.5),
-		Palette::Darkred.lerp(Palette::Black, 0.5),
-	};
+	// 地面
+	const Ground ground;
 
 	// シーン進行管理
 	Stopwatch timeTitle{ StartImmediately::Yes };
 	Stopwatch timeGame;
 	Stopwatch timeStage;
 	int stage = 0;
-	const int StageCount = 3;
-	Stopwatch timeJudgeParking;
+	ParkingJudge judge;
 	Stopwatch timeShowRecord;
 	Stopwatch timeGameover;
 
@@ -687,9 +5494,106 @@ void Main()
 
 	// 記録
 	Optional<int32> record;
-	
+
+	// デバッグ用の統計情報
+	DebugStats stats;
+
+	// 自動運転（--play）: プランナーが書き出した入力列があるステージでは、キー入力の代わりにそれを再生する
+	Array<Optional<InputTrack>> autopilot(StageCount + 1);
+
+	if (System::GetCommandLineArgs().includes(U"--play"))
+	{
+		for (int s = 1; s <= StageCount; ++s)
+		{
+			autopilot[s] = InputTrack::Load(MotionPlanner::TrackPath(s));
+		}
+	}
+
+	// ステージの定義ファイルのホットリロード（--hot-reload）
+	Optional<StageHotReloader> hotReloader;
+
+	if (System::GetCommandLineArgs().includes(U"--hot-reload"))
+	{
+		hotReloader.emplace();
+	}
+
+	// 巻き戻し・リトライ用の履歴
+	StageHistory history;
+	Array<uint32> snapshotWords;
+	int32 simTick = 0;
+	bool rewinding = false;
+
+	// 巻き戻すティック数の端数（1 フレームあたりのティック数は整数にならないので、次のフレームに持ち越す）
+	double rewindTickCarry = 0;
+
+	// ステージを読み込み、履歴を開始時の状態から記録し直す
+	const auto loadStage = [&](int s)
+		{
+			session.load(s, player, hotReloader ? &*hotReloader : nullptr);
+
+			// 定義ファイルの敵が多すぎて作らなかった分は、統計情報の RELOAD の行に出す
+			if (hotReloader)
+			{
+				stats.reload = StageReloadResult{ .enemiesDropped = hotReloader->enemiesDroppedOnLoad() };
+			}
+
+			simTick = 0;
+			WorldSnapshot::Capture(player, enemies, 0, snapshotWords);
+			history.reset(snapshotWords);
+
+			// 巻き戻しの途中で読み込んでも、新しいステージはワールドを進める状態から始める
+			rewinding = false;
+			rewindTickCarry = 0;
+		};
+
+	// 履歴の tick の状態に戻す（直前のスナップショットを復元し、記録した入力で tick まで進め直す）
+	const auto rewindTo = [&](int32 tick)
+		{
+			const Optional<int32> snapshotTick = history.find(tick, snapshotWords);
+
+			if (not snapshotTick) return;
+
+			int64 stageTimeUs = WorldSnapshot::Restore(snapshotWords, player, enemies);
+
+			for (int32 t = *snapshotTick; t < tick; ++t)
+			{
+				const auto [input, paused] = history.input(t);
+				StepStage(world, player, enemies, input, paused);
+				stageTimeUs += static_cast<int64>(StepSec * 1'000'000);
+			}
+
+			simTick = tick;
+			timeStage.set(MicrosecondsF{ static_cast<double>(stageTimeUs) });
+
+			// プレイヤーが跳んだ先のチャンクを、その場で読み込む
+			streamer.prime(player.pos(), StageStreamer::LoadRadius(camera.scale()));
+		};
+
 	while (System::Update())
 	{
+		// 前のフレームが表示された時刻で入力遅延を計測
+		inputLatency.presented(Time::GetMicrosec());
+
+		// 前のフレーム全体（System::Update() を含む）でのヒープ確保の回数
+		const uint64 allocationCount = AllocationCounter::Count();
+		stats.heapAllocations = allocationCount - lastAllocationCount;
+		lastAllocationCount = allocationCount;
+
+		stats.frameArenaBytes = frameArena.used();
+		frameArena.reset();
+
+		// 入力を待たずに済むよう、フレームの頭で待機してから入力を取り込む
+		pacer.wait();
+
+		inputEvents.clear();
+		inputSampler.collect(inputEvents);
+		inputTimeline.push(inputEvents);
+
+		if (KeyF1.down())
+		{
+			stats.visible = not stats.visible;
+		}
+
 		// タイトルシーン
 		if (timeTitle.isRunning())
 		{
@@ -697,7 +5601,7 @@ void Main()
 			{
 				// メインのシーンに移行
 				stage = 1;
-				LoadStage(stage, world, walls, enemies, player, goal, smokeEffect, sparkEffect);
+				loadStage(stage);
 
 				timeTitle.reset();
 				timeGame.start();
@@ -740,7 +5644,7 @@ void Main()
 					{
 						// タイトルへ
 						stage = 0;
-						LoadStage(0, world, walls, enemies, player, goal, smokeEffect, sparkEffect);
+						loadStage(0);
 
 						timeShowMenu.reset();
 						timeGame.reset();
@@ -752,45 +5656,71 @@ void Main()
 				}
 			}
 
-			// スペースキーでカメラズームアウト
-			if (KeySpace.pressed())
+			// R キーでステージの最初からやり直す（剛体は作り直さない）
+			if (KeyR.down() && stage >= 1 && not timeShowMenu.isRunning() && not timeShowRecord.isRunning())
 			{
-				zoom = Clamp(zoom - 2.0 * Scene::DeltaTime(), 0.65, 1.0);
+				WorldSnapshot::Restore(history.initial(), player, enemies);
+				history.reset(history.initial());
+				simTick = 0;
+				accumulatorSec = 0;
+				streamer.prime(player.pos(), StageStreamer::LoadRadius(camera.scale()));
+
+				player.hideTrails();
+				session.clearEffects();
+
+				timeStage.restart();
+				judge.reset();
+				timeGameover.reset();
 			}
-			else
+
+			// BackSpace キーを押している間、実時間の 2 倍の速さで巻き戻す
+			const bool wasRewinding = rewinding;
+			rewinding = KeyBackspace.pressed() && timeStage.isRunning() && not timeShowMenu.isRunning();
+
+			if (rewinding)
+			{
+				rewindTickCarry += 2.0 * Scene::DeltaTime() / StepSec;
+				const int32 rewindTicks = static_cast<int32>(rewindTickCarry);
+				rewindTickCarry -= rewindTicks;
+
+				if (rewindTicks > 0)
+				{
+					rewindTo(Max(history.oldestTick(), simTick - rewindTicks));
+				}
+
+				accumulatorSec = 0;
+
+				judge.reset();
+
+				if (player.life() > 0)
+				{
+					timeGameover.reset();
+				}
+			}
+			else if (wasRewinding)
 			{
-				zoom = Clamp(zoom + 6.0 * Scene::DeltaTime(), 0.65, 1.0);
+				// 巻き戻した位置から記録し直す
+				history.truncateAfter(simTick);
+				rewindTickCarry = 0;
 			}
 
-			camera.setScale(zoom);
+			// スペースキーでカメラズームアウト
+			camera.zoom(SinglePlayerKeys.zoomOut.pressed(), Scene::DeltaTime());
 		}
 
 		// メインシーン
 
-		const bool isInGoal = goal.area.contains(player.bodyQuad());
+		const bool isInGoal = session.goal.area.contains(player.bodyQuad());
 
 		if (timeStage.isRunning())
 		{
 			// ゴールに完全に入ったかの判定…
-
-			if (not timeJudgeParking.isRunning() && isInGoal)
-			{
-				timeJudgeParking.restart();
-			}
-
-			if (timeJudgeParking.isRunning())
+			if (judge.update(isInGoal) && not timeGameover.isRunning())
 			{
-				if (not isInGoal)
-				{
-					timeJudgeParking.reset();
-				}
-				else if (timeJudgeParking > 1s && not timeGameover.isRunning())
-				{
-					// クリアしたのでクリアタイム表示へ移行
-					timeJudgeParking.reset();
-					timeStage.pause();
-					timeShowRecord.restart();
-				}
+				// クリアしたのでクリアタイム表示へ移行
+				judge.reset();
+				timeStage.pause();
+				timeShowRecord.restart();
 			}
 
 			// プレイヤーが壊れている？
@@ -803,7 +5733,7 @@ void Main()
 			{
 				// タイトルへ
 				stage = 0;
-				LoadStage(0, world, walls, enemies, player, goal, smokeEffect, sparkEffect);
+				loadStage(0);
 
 				timeGameover.reset();
 				timeGame.reset();
@@ -824,7 +5754,7 @@ void Main()
 				if (stage < StageCount)
 				{
 					stage += 1;
-					LoadStage(stage, world, walls, enemies, player, goal, smokeEffect, sparkEffect);
+					loadStage(stage);
 
 					timeStage.restart();
 					timeShowRecord.reset();
@@ -840,7 +5770,7 @@ void Main()
 					}
 
 					stage = 0;
-					LoadStage(0, world, walls, enemies, player, goal, smokeEffect, sparkEffect);
+					loadStage(0);
 
 					timeGame.reset();
 					timeStage.reset();
@@ -851,48 +5781,89 @@ void Main()
 			}
 		}
 
-		// 2D 物理演算のワールドを更新
-		for (accumulatorSec += Scene::DeltaTime(); (StepSec <= accumulatorSec); accumulatorSec -= StepSec)
+		// ステージの定義ファイルが書き換わっていたら、変わった壁と敵だけを反映する
+		if (hotReloader)
 		{
-			player.updateAsPlayer(StepSec, timeShowMenu.isRunning());
-
-			for (auto& e : enemies)
+			if (const auto result = hotReloader->update(world, streamer, enemies, player, session.goal, session.collisionRules, session.minimap, session.smokeEffect, session.sparkEffect))
 			{
-				e.updateAsEnemy(StepSec, 0);
-			}
+				stats.reload = *result;
 
-			world.update(StepSec);
+				// 履歴は反映した時点から記録し直す（それより前の状態は、今の敵の並びと合わない）
+				simTick = 0;
+				WorldSnapshot::Capture(player, enemies, timeStage.us64(), snapshotWords);
+				history.reset(snapshotWords);
+			}
 		}
 
-		for (auto& e : enemies)
+		session.updateEffects(Scene::DeltaTime());
+
+		// 2D 物理演算のワールドを更新
+		const uint64 frameTimeUs = Time::GetMicrosec();
+
+		if (rewinding)
+		{
+			// 巻き戻している間はワールドを進めず、記録もしない（記録済みの入力を上書きしないように）
+			// 入力は取り込んでおき、離したときに押されているキーの状態から再開する
+			inputTimeline.advanceTo(frameTimeUs, inputLatency);
+		}
+		else
 		{
-			if (e.alive() && e.life() <= 0)
+			for (accumulatorSec += Scene::DeltaTime(); (StepSec <= accumulatorSec); accumulatorSec -= StepSec)
 			{
-				e.releaseBody();
+				// このサブステップが表す時刻までに起きた入力を反映
+				const uint64 substepTimeUs = SubstepTimeUs(frameTimeUs, accumulatorSec);
+				InputState input = inputTimeline.advanceTo(substepTimeUs, inputLatency);
+
+				if (autopilot[stage] && timeStage.isRunning())
+				{
+					input = autopilot[stage]->at(simTick);
+				}
+				const bool paused = timeShowMenu.isRunning();
+
+				// 巻き戻し・リトライ用に記録
+				if (timeStage.isRunning())
+				{
+					if (StageHistory::IsSnapshotTick(simTick))
+					{
+						WorldSnapshot::Capture(player, enemies, timeStage.us64(), snapshotWords);
+						history.recordSnapshot(simTick, snapshotWords);
+					}
+
+					history.recordInput(simTick, input, paused);
+				}
+
+				StepStage(world, player, enemies, input, paused);
+				++simTick;
 			}
 		}
 
 		// カメラをプレイヤーに追従
-		camera.setTargetCenter(player.pos());
-		camera.update();
+		camera.follow(player.pos());
+
+		// プレイヤーの周囲のチャンクを読み込む
+		streamer.update(player.pos(), StageStreamer::LoadRadius(camera.scale()));
+
+		// 敵の詳細度を画面上での大きさと位置から決める（プレイヤーは常に詳細表示）
+		session.updateLods(std::span{ &camera, 1 });
+		session.buildDrawLists();
 
 		// 描画
 		{
 			const ScopedRenderTarget2D renderTarget{ renderTexture };
 
 			// 背景全体の色
-			Scene::Rect().draw(groundColor[stage]);
+			Scene::Rect().draw(ground.color(stage));
 
 			// タイトルシーン
 			if (timeTitle.isRunning())
 			{
-				FontAsset(U"Title")(U"PARKING").drawAt(24, SceneCenter.movedBy(0, -36), ColorF{1.0, 0.5});
-				FontAsset(U"Title")(U"PRESS ENTER").drawAt(12, SceneCenter.movedBy(0, 36), ColorF{ 1.0, 0.5 });
+				titleLabel.drawAt(SceneCenter.movedBy(0, -36), ColorF{ 1.0, 0.5 });
+				pressEnterLabel.drawAt(SceneCenter.movedBy(0, 36), ColorF{ 1.0, 0.5 });
 
 				if (record)
 				{
-					FontAsset(U"Title")(U"BEST REC. {:02d}:{:02d}.{:02d}"_fmt(*record / 1000 / 60, (*record / 1000) % 60, (*record % 1000) / 10))
-						.drawAt(12, SceneCenter.movedBy(0, 110), ColorF{ 1.0, 0.5 });
+					bestRecordLabel.update(*record, U"BEST REC. ", Padded{ *record / 1000 / 60, 2 }, U":", Padded{ (*record / 1000) % 60, 2 }, U".", Padded{ (*record % 1000) / 10, 2 });
+					bestRecordLabel.drawAt(SceneCenter.movedBy(0, 110), ColorF{ 1.0, 0.5 });
 				}
 			}
 
@@ -900,92 +5871,58 @@ void Main()
 				// 2D カメラ
 				const auto cameraTr = camera.createTransformer();
 
-				// 共通
-				{
-					//プレイヤーの角度に追従した回転
-					const Transformer2D rotTr(Mat3x2::Rotate(-player.angle(), player.pos()));
-
-					// ゴール
-					goal.area
-						.draw(ColorF{ 1.0, 0.1 + 0.1 * Periodic::Jump1_1(0.1s) })
-						.drawFrame(4, 0, ColorF{ isInGoal ? Palette::Lime : Palette::White, 0.75 + 0.25 * Periodic::Jump1_1(0.2s) });
-
-					// 地面
-					{
-						const ScopedRenderStates2D sampler{ SamplerState::RepeatNearest };
-
-						groundTexture.mapped(40000, 40000).draw(Arg::center = Vec2::Zero(), AlphaF(0.1));
-					}
-
-					// 壁
-					for (const auto& wall : walls)
-					{
-						wall.rect.draw(Palette::Whitesmoke);
-					}
-
-					// 煙
-					smokeEffect.update();
-
-					// プレイヤー
-					player.draw();
-
-					// 敵
-					for (const auto& e : enemies)
-					{
-						e.draw();
-					}
+				//プレイヤーの角度に追従した回転
+				const Transformer2D rotTr(Mat3x2::Rotate(-player.angle(), player.pos()));
 
-					// スパーク
-					sparkEffect.update();
-				}
+				// ゴール・地面・壁・煙・プレイヤー・敵・スパーク（画面に映る範囲だけ）
+				session.draw(ground, std::span{ &player, 1 }, camera.visibleRect(SceneSize), isInGoal, simTick);
 			}
 
 			// ゲームシーン
 			if (timeStage.isRunning())
 			{
 				// タイム
-				const auto textTime = FontAsset(U"Title")(U"{:02d}:{:02d}.{:02d}"_fmt(timeStage.min(), timeStage.s() % 60, (timeStage.ms() % 1000) / 10));
-				textTime.drawAt(12, SceneCenter.movedBy(1, -118 + 1), ColorF{ 0, 0.5 });
-				textTime.drawAt(12, SceneCenter.movedBy(0, -118), ColorF{ 1.0 });
+				DrawStageTime(timeLabel, timeStage);
 
 				// ステージ名
 				if (timeStage < 3s)
 				{
 					RectF{ Arg::center = SceneCenter.movedBy(0, 110 + 2), 256, 20 }.draw(Palette::Black);
-					const auto text = FontAsset(U"Title")(U"STAGE {}"_fmt(stage));
-					text.drawAt(12, SceneCenter.movedBy(1, 110 + 1), ColorF{ 0, 0.5 });
-					text.drawAt(12, SceneCenter.movedBy(0, 110), ColorF{ 1.0 });
+					stageLabel.update(stage, U"STAGE ", stage);
+					stageLabel.drawAt(SceneCenter.movedBy(0, 110));
 				}
+
+				// ミニマップ
+				session.minimap.draw(Vec2{ SceneWidth - Minimap::Size - 4, 4 }, player, enemies, session.goal);
 			}
 
 			// ステージのクリアタイム表示
 			if (timeShowRecord.isRunning())
 			{
-				const auto textRec = FontAsset(U"Title")(U"RECORD {:02d}:{:02d}.{:02d}"_fmt(timeStage.min(), timeStage.s() % 60, (timeStage.ms() % 1000) / 10));
+				const int64 centisec = timeStage.ms() / 10;
+				recordLabel.update(centisec, U"RECORD ", Padded{ centisec / 6000, 2 }, U":", Padded{ (centisec / 100) % 60, 2 }, U".", Padded{ centisec % 100, 2 });
 				const double alpha = timeShowRecord < 1s ? Periodic::Square0_1(0.2s) : 1.0;
-				textRec.drawAt(12, SceneCenter.movedBy(1, -48 + 1), ColorF{ 0, 0.5 * alpha });
-				textRec.drawAt(12, SceneCenter.movedBy(0, -48), ColorF{ 1.0, alpha });
+				recordLabel.drawAt(SceneCenter.movedBy(0, -48), ColorF{ 1.0, alpha });
 			}
 
 			// タイトルに戻る？メニュー
 			if (timeShowMenu.isRunning())
 			{
 				RectF{ Arg::center = SceneCenter, 256, 256 }.draw(ColorF{ 0, 0.8 });
-				FontAsset(U"Title")(U"RETURN TO TITLE?").drawAt(12, SceneCenter.movedBy(0, -48), ColorF{ 1.0 });
+				menuLabel.drawAt(SceneCenter.movedBy(0, -48));
 
 				RectF{ Arg::center = SceneCenter.movedBy(0, 30 + 18 * menuCursor + 2), 256, 14 }.draw(ColorF{ Palette::Blue, 0.8 * Periodic::Jump0_1(0.3s) });
 
-				FontAsset(U"Title")(U"CANCEL").drawAt(12, SceneCenter.movedBy(0, 30), ColorF{ 0.7 + 0.3 * (menuCursor == 0) });
-				FontAsset(U"Title")(U"OK (TO TITLE)").drawAt(12, SceneCenter.movedBy(0, 48), ColorF{ 0.7 + 0.3 * (menuCursor == 1) });
+				cancelLabel.drawAt(SceneCenter.movedBy(0, 30), ColorF{ 0.7 + 0.3 * (menuCursor == 0) });
+				okLabel.drawAt(SceneCenter.movedBy(0, 48), ColorF{ 0.7 + 0.3 * (menuCursor == 1) });
 			}
 
 			// ゲームオーバー
 			if (timeGameover.isRunning())
 			{
 				RectF{ Arg::center = SceneCenter, 256, 256 }.draw(ColorF{ Palette::Darkred, 0.3 });
-				const auto text = FontAsset(U"Title")(U"GAME OVER");
-				text.drawAt(24, SceneCenter.movedBy(2, 2), ColorF{ 0, 0.5 });
-				text.drawAt(24, SceneCenter.movedBy(0, 0), ColorF{ 1.0 });
+				gameoverLabel.drawAt(SceneCenter);
+				retryLabel.drawAt(SceneCenter.movedBy(0, 36), ColorF{ 1.0, 0.5 });
 			}
 		}
 
@@ -995,5 +5932,31 @@ void Main()
 		}
 
 		Circle{ Scene::CenterF(), Scene::Width() * Math::Sqrt2 / 2 }.draw(ColorF{ 0, 0 }, ColorF{ 0, 0.2 });
+
+		// デバッグ用の統計情報
+		stats.inputLatencyMs = inputLatency.lastMs();
+		stats.inputLatencyAverageMs = inputLatency.averageMs();
+		stats.loadedChunks = streamer.loadedChunkCount();
+		stats.totalChunks = streamer.chunkCount();
+		stats.visibleWalls = streamer.visibleWalls().size();
+		stats.wallBodies = streamer.walls().size();
+		stats.historyBytes = history.byteSize();
+		stats.historySec = (simTick - history.oldestTick()) * StepSec;
+		stats.contacts = world.getCollisions().size();
+		stats.carLods.fill(0);
+
+		for (const auto& e : enemies)
+		{
+			if (e.alive())
+			{
+				++stats.carLods[FromEnum(e.lod())];
+			}
+		}
+
+		// ステージ用のアリーナにあるのは壁の剛体と id の配列だけ（ホットリロードで配列を伸ばす前の古い領域も、ステージの間は残る）
+		stats.stageArenaBytes = session.stageArena.used();
+		stats.hudRenders = HudLabel::RenderCount() - lastHudRenderCount;
+		lastHudRenderCount = HudLabel::RenderCount();
+		stats.draw(font, &frameArena);
 	}
 }